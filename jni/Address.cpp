@@ -15,16 +15,16 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+
 #include "Address.h"
 #include "Utility.h"
 
-const std::string Address::GetComment(const std::set<Range> &range_set) const {
-  for (auto it = range_set.begin(); it != range_set.end(); it++) {
-    if (it->GetStart() <= *this && *this < it->GetEnd()) {
-      return it->GetComment();
-    }
-  }
-  return "";
+const std::string &Address::GetComment(const RangeIndex &range_index) const {
+  const Range *range = range_index.Find(*this);
+  return range != nullptr ? range->GetComment() : Range().GetComment();
 }
 void Address::Serialize(FILE *fp) const { fprintf(fp, "_%zd", addr_); }
 Address Address::DeSerialize(FILE *fp) {
@@ -33,29 +33,37 @@ Address Address::DeSerialize(FILE *fp) {
   return Address(addr);
 }
 
-Address Range::Fit(const std::set<Range> &range_set, const Address &address) {
-  for (auto it = range_set.begin(); it != range_set.end(); it++) {
-    if (it->GetStart() <= address && address < it->GetEnd()) {
-      return address;
-    }
+Address Range::Fit(const RangeIndex &range_index, const Address &address) {
+  return range_index.Find(address) != nullptr ? address : Address(0);
+}
+
+Range Range::Fit(const RangeIndex &range_index, const Range &range) {
+  const Range *it = range_index.FindOverlap(range);
+  if (it == nullptr) {
+    return Range(0, 0, "");
   }
-  return Address(0);
+  Range ret = range;
+  ret.start_ = std::max(it->GetStart(), range.GetStart());
+  ret.end_ = std::min(it->GetEnd(), range.GetEnd());
+  return ret;
 }
 
-Range Range::Fit(const std::set<Range> &range_set, const Range &range) {
-  for (auto it = range_set.begin(); it != range_set.end(); it++) {
-    if ((it->GetStart() <= range.GetStart() && range.GetStart() < it->GetEnd()) ||
-        (range.GetStart() <= it->GetStart() && it->GetStart() < range.GetEnd())) {
-      return Range(std::max(it->GetStart().to_i(), range.GetStart().to_i()),
-                   std::min(it->GetEnd().to_i(), range.GetEnd().to_i()), range.GetComment());
-    }
+const std::string *Range::Intern(const std::string &comment) {
+  // 空のコメントが一番多いので、ロックを取らずに返す
+  static const std::string empty;
+  if (comment.empty()) {
+    return &empty;
   }
-  return Range(0, 0, "");
+  // unordered_setの要素は再ハッシュしても移動しない
+  static std::mutex mutex;
+  static std::unordered_set<std::string> pool;
+  std::lock_guard<std::mutex> lock(mutex);
+  return &*pool.insert(comment).first;
 }
 void Range::Serialize(FILE *fp) const {
   start_.Serialize(fp);
   end_.Serialize(fp);
-  Utility::StringSerialize(fp, comment_);
+  Utility::StringSerialize(fp, *comment_);
 }
 Range Range::DeSerialize(FILE *fp) {
   Address start = Address::DeSerialize(fp);
@@ -63,3 +71,33 @@ Range Range::DeSerialize(FILE *fp) {
   std::string comment = Utility::StringDeSerialize(fp);
   return Range(start, end, comment);
 }
+
+void RangeIndex::Build(const RangeSet &range_set) {
+  starts_.clear();
+  ranges_.assign(range_set.begin(), range_set.end());
+  starts_.reserve(ranges_.size());
+  for (auto it = ranges_.begin(); it != ranges_.end(); it++) {
+    starts_.push_back(it->GetStart().to_i());
+  }
+}
+
+const Range *RangeIndex::Find(const Address &address) const {
+  // addressより後から始まる最初のRangeの1つ前だけが、addressを含み得る
+  size_t i = std::upper_bound(starts_.begin(), starts_.end(), address.to_i()) - starts_.begin();
+  if (i == 0 || address >= ranges_[i - 1].GetEnd()) {
+    return nullptr;
+  }
+  return &ranges_[i - 1];
+}
+
+const Range *RangeIndex::FindOverlap(const Range &range) const {
+  size_t i = std::upper_bound(starts_.begin(), starts_.end(), range.GetStart().to_i()) - starts_.begin();
+  if (i > 0 && range.GetStart() < ranges_[i - 1].GetEnd()) {
+    return &ranges_[i - 1];
+  }
+  // rangeの先頭がどこにも含まれない場合は、rangeの中で始まる最初のRange
+  if (i < ranges_.size() && ranges_[i].GetStart() < range.GetEnd()) {
+    return &ranges_[i];
+  }
+  return nullptr;
+}
@@ -20,10 +20,12 @@
 #include <set>
 #include <stdlib.h>
 #include <string>
+#include <vector>
 
 #include "ChangeString.h"
 
 class Range;
+class RangeIndex;
 class Address {
 public:
   Address() : addr_(0) { ; }
@@ -42,29 +44,33 @@ public:
 
   void Serialize(FILE *fp) const;
   static Address DeSerialize(FILE *fp);
-  const std::string GetComment(const std::set<Range> &range_set) const;
+  // addressを含むRangeのコメント、どこにも含まれなければ空文字列
+  const std::string &GetComment(const RangeIndex &range_index) const;
 
 private:
   size_t addr_;
 };
 
 // [start, end)
+// コメントは同じ文字列を1つだけ持つようにして、Rangeのコピーで文字列をコピーしない
 class Range {
 public:
-  Range() { ; }
-  Range(const Address &start, const Address &end) : start_(start), end_(end) { assert(end >= start); }
+  Range() : comment_(Intern("")) { ; }
+  Range(const Address &start, const Address &end) : start_(start), end_(end), comment_(Intern("")) {
+    assert(end >= start);
+  }
   Range(const Address &start, const Address &end, const std::string &comment)
-      : start_(start), end_(end), comment_(comment) {
+      : start_(start), end_(end), comment_(Intern(comment)) {
     assert(end >= start);
   }
   Range(const size_t start, const size_t end, const std::string &comment)
-      : start_(start), end_(end), comment_(comment) {
+      : start_(start), end_(end), comment_(Intern(comment)) {
     assert(end >= start);
   }
   const Address &GetStart() const { return start_; }
   const Address &GetEnd() const { return end_; }
   size_t Size() const { return end_.to_i() - start_.to_i(); }
-  const std::string &GetComment() const { return comment_; }
+  const std::string &GetComment() const { return *comment_; }
 
   bool operator<(const Range &rhs) const {
     if (start_ < rhs.start_ || rhs.start_ < start_) {
@@ -78,21 +84,46 @@ public:
   }
   bool isSubset(const Range &super) const { return super.IsSuperset(*this); }
 
-  // addressやrangeがrange_setの内部に入る様にする
-  // range_setの外にある場合はaddressを0にする
-  static Address Fit(const std::set<Range> &range_set, const Address &address);
-  static Range Fit(const std::set<Range> &range_set, const Range &range);
+  // addressやrangeがrange_indexの内部に入る様にする
+  // range_indexの外にある場合はaddressを0にする
+  static Address Fit(const RangeIndex &range_index, const Address &address);
+  static Range Fit(const RangeIndex &range_index, const Range &range);
 
   void Serialize(FILE *fp) const;
   static Range DeSerialize(FILE *fp);
 
 private:
+  // 同じ内容なら同じポインタを返す、プロセスが終わるまで解放しない
+  static const std::string *Intern(const std::string &comment);
+
   Address start_;
   Address end_;
-  std::string comment_; // const指定するとデフォルトのコピーコンストラクタが使えなくなる
+  const std::string *comment_;
 };
 typedef std::set<Range> RangeSet;
 
+/**
+ * RangeSetを開始アドレスの配列に並べ直して、アドレスを含むRangeを二分探索で引けるようにしたもの
+ * /proc/pid/mapsのように、Rangeが互いに重ならないことを想定している
+ * CreateRangeSetでRangeSetを作り直す度に作り直す
+ */
+class RangeIndex {
+public:
+  RangeIndex() { ; }
+  explicit RangeIndex(const RangeSet &range_set) { Build(range_set); }
+  void Build(const RangeSet &range_set);
+
+  // addressを含むRange、無ければnullptr
+  const Range *Find(const Address &address) const;
+  // rangeと重なる一番前のRange、無ければnullptr
+  const Range *FindOverlap(const Range &range) const;
+  size_t Size() const { return ranges_.size(); }
+
+private:
+  std::vector<size_t> starts_; // 二分探索用にranges_の開始アドレスだけを並べたもの
+  std::vector<Range> ranges_;
+};
+
 class TargetAddress {
 public:
   TargetAddress() { ; }
@@ -18,7 +18,7 @@ include $(CLEAR_VARS)
 LOCAL_CFLAGS    := -std=c++14 -Wall -g -D_FILE_OFFSET_BITS=64 -D__IS_NDK_BUILD__=1 -O2 -fvisibility=hidden
 LOCAL_MODULE    := mempatch
 LOCAL_SRC_FILES := main.cpp Patcher.cpp ChangeString.cpp Memory_Linux.cpp Utility.cpp Converter.cpp Address.cpp LineReader.cpp linenoise/linenoise.cpp FreezeThread.cpp
-LOCAL_SRC_FILES += SnappedRange.cpp
+LOCAL_SRC_FILES += SnappedRange.cpp RangeScanner.cpp ReadCache.cpp Search.cpp NumericPredicate.cpp CandidateSet.cpp SpillFile.cpp ReadPlanner.cpp Snapshot.cpp lz4/Lz4Block.cpp
 LOCAL_LDLIBS    := -llog -latomic
 LOCAL_CFLAGS    += -fPIE
 LOCAL_LDFLAGS   += -fPIE -pie -pthread
@@ -0,0 +1,427 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <assert.h>
+
+#include "CandidateSet.h"
+#include "Utility.h"
+
+CandidateSet::const_iterator::const_iterator(const CandidateSet *set, size_t region, size_t index)
+    : set_(set), region_(region), pos_(0), bits_(0) {
+  current_.index = index;
+  current_.address = 0;
+  if (index < set_->Size()) {
+    Load();
+  }
+}
+
+void CandidateSet::const_iterator::Load() {
+  const Region &region = set_->regions_[region_];
+  size_t k = current_.index - region.begin;
+  if (!region.bitmap) {
+    pos_ = region.data + k;
+    current_.address = region.base + set_->offsets_[pos_];
+    return;
+  }
+  // k番目の立っているビットを探す
+  pos_ = region.data;
+  while (true) {
+    size_t cnt = __builtin_popcountll(set_->bitmaps_[pos_]);
+    if (k < cnt) {
+      break;
+    }
+    k -= cnt;
+    pos_++;
+  }
+  bits_ = set_->bitmaps_[pos_];
+  for (; k > 0; k--) {
+    bits_ &= bits_ - 1;
+  }
+  current_.address = region.base + ((((pos_ - region.data) * 64) + __builtin_ctzll(bits_)) << region.shift);
+}
+
+CandidateSet::const_iterator &CandidateSet::const_iterator::operator++() {
+  current_.index++;
+  if (current_.index >= set_->Size()) {
+    region_ = set_->regions_.size();
+    current_.address = 0;
+    return *this;
+  }
+  if (set_->regions_[region_].end <= current_.index) {
+    region_++;
+    Load();
+    return *this;
+  }
+  const Region &region = set_->regions_[region_];
+  if (!region.bitmap) {
+    pos_++;
+    current_.address = region.base + set_->offsets_[pos_];
+    return *this;
+  }
+  // 語単位で次の立っているビットを探す
+  bits_ &= bits_ - 1;
+  while (bits_ == 0) {
+    bits_ = set_->bitmaps_[++pos_];
+  }
+  current_.address = region.base + ((((pos_ - region.data) * 64) + __builtin_ctzll(bits_)) << region.shift);
+  return *this;
+}
+
+CandidateSet::const_iterator CandidateSet::At(size_t index) const {
+  if (index >= Size()) {
+    return end();
+  }
+  auto it = std::upper_bound(regions_.begin(), regions_.end(), index,
+                             [](size_t i, const Region &region) { return i < region.end; });
+  return const_iterator(this, it - regions_.begin(), index);
+}
+
+void CandidateSet::Reset(const ChangeString &change_str) { Reset(std::vector<ChangeString>(1, change_str)); }
+
+void CandidateSet::Reset(const std::vector<ChangeString> &rules) {
+  regions_.clear();
+  offsets_.clear();
+  bitmaps_.clear();
+  count_ = 0;
+  rules_ = rules;
+  rule_ids_.clear();
+  values_.clear();
+  value_size_ = 0;
+  spill_failed_ = false;
+}
+
+void CandidateSet::ResetValues(const Converter::Type &type, size_t size) {
+  Reset(ChangeString(type, std::vector<uint8_t>(size, 0)));
+  value_size_ = size;
+}
+
+CandidateSet CandidateSet::EmptyCopy() const {
+  CandidateSet ret;
+  ret.rules_ = rules_;
+  ret.value_size_ = value_size_;
+  return ret;
+}
+
+/**
+ * 前のアドレスより小さいか、区間の基準から32ビットで表せないか、前のアドレスから離れている場合は新しい区間にする
+ */
+void CandidateSet::PushAddress(size_t address) {
+  bool fresh = regions_.empty() || address < last_address_ || address - regions_.back().base > UINT32_MAX ||
+               address - last_address_ > MAX_GAP;
+  if (!fresh) {
+    const Region &region = regions_.back();
+    if (region.bitmap) {
+      // ビットマップには同じアドレスや、間隔の倍数でないアドレスは入れられない
+      fresh = address == last_address_ || ((address - region.base) & ((1 << region.shift) - 1)) != 0 ||
+              region.words * sizeof(uint64_t) >= MAX_REGION_BYTES;
+    } else {
+      fresh = (region.end - region.begin) * sizeof(uint32_t) >= MAX_REGION_BYTES;
+    }
+  }
+  if (fresh) {
+    if (!regions_.empty()) {
+      ChooseRepresentation(false);
+    }
+    regions_.push_back(Region{address, count_, count_, offsets_.size(), 0, 0, false});
+    open_or_ = 0;
+    open_unique_ = true;
+  } else if (address == last_address_) {
+    open_unique_ = false;
+  }
+
+  Region &region = regions_.back();
+  const size_t offset = address - region.base;
+  if (region.bitmap) {
+    const size_t k = offset >> region.shift;
+    if (k / 64 >= region.words) {
+      region.words = k / 64 + 1;
+      bitmaps_.resize(region.data + region.words, 0);
+    }
+    bitmaps_.Mutable(region.data + k / 64) |= 1ULL << (k % 64);
+  } else {
+    offsets_.push_back(offset);
+  }
+  open_or_ |= offset;
+  region.end = ++count_;
+  last_address_ = address;
+  if (!region.bitmap && (region.end - region.begin) % CHECK_INTERVAL == 0) {
+    ChooseRepresentation(true);
+  }
+}
+
+/**
+ * 最後の区間を、オフセットの配列とビットマップの小さい方にする
+ * 追加中(growing)の場合は、後でまばらになっても閉じる時に配列に戻す
+ */
+void CandidateSet::ChooseRepresentation(bool growing) {
+  const Region &region = regions_.back();
+  const size_t n = region.end - region.begin;
+  if (region.bitmap) {
+    if (!growing && n * sizeof(uint32_t) < region.words * sizeof(uint64_t)) {
+      ToArray();
+    }
+    return;
+  }
+  if (!open_unique_) {
+    return;
+  }
+  const int shift = __builtin_ctz(open_or_ | 8);
+  const size_t words = ((last_address_ - region.base) >> shift) / 64 + 1;
+  if (words * sizeof(uint64_t) < n * sizeof(uint32_t)) {
+    ToBitmap();
+  }
+}
+
+void CandidateSet::ToBitmap() {
+  Region &region = regions_.back();
+  const int shift = __builtin_ctz(open_or_ | 8);
+  const size_t words = ((last_address_ - region.base) >> shift) / 64 + 1;
+  const size_t data = bitmaps_.size();
+  bitmaps_.resize(data + words, 0);
+  for (size_t i = region.data; i < offsets_.size(); i++) {
+    const size_t k = offsets_[i] >> shift;
+    bitmaps_.Mutable(data + k / 64) |= 1ULL << (k % 64);
+  }
+  offsets_.resize(region.data);
+  region.data = data;
+  region.words = words;
+  region.shift = shift;
+  region.bitmap = true;
+}
+
+void CandidateSet::ToArray() {
+  Region &region = regions_.back();
+  const size_t data = offsets_.size();
+  for (size_t w = 0; w < region.words; w++) {
+    for (uint64_t bits = bitmaps_[region.data + w]; bits != 0; bits &= bits - 1) {
+      offsets_.push_back((w * 64 + __builtin_ctzll(bits)) << region.shift);
+    }
+  }
+  bitmaps_.resize(region.data);
+  region.data = data;
+  region.words = 0;
+  region.shift = 0;
+  region.bitmap = false;
+}
+
+/**
+ * メモリ上の大きさがbudgetを超えていたら、閉じた区間の分を書き出す
+ * 最後の区間はまだ持ち方が変わるかもしれないので残す
+ */
+void CandidateSet::CheckBudget() {
+  if (budget_ == 0 || spill_failed_ || count_ % CHECK_INTERVAL != 0 || GetMemorySize() <= budget_) {
+    return;
+  }
+  const Region &region = regions_.back();
+  const bool ret = offsets_.Spill(region.bitmap ? offsets_.size() : region.data) &&
+                   bitmaps_.Spill(region.bitmap ? region.data : bitmaps_.size()) &&
+                   rule_ids_.Spill(rule_ids_.size()) && values_.Spill(values_.size());
+  if (!ret) {
+    Utility::DebugLog("keep the address set in memory");
+    spill_failed_ = true;
+  }
+}
+
+void CandidateSet::Shrink() {
+  if (!regions_.empty()) {
+    ChooseRepresentation(false);
+  }
+  offsets_.shrink_to_fit();
+  bitmaps_.shrink_to_fit();
+}
+
+size_t CandidateSet::GetBitmapRegionCount() const {
+  size_t ret = 0;
+  for (auto it = regions_.begin(); it != regions_.end(); it++) {
+    ret += it->bitmap ? 1 : 0;
+  }
+  return ret;
+}
+
+void CandidateSet::Push(size_t address, size_t rule) {
+  assert(value_size_ == 0 && rule < rules_.size());
+  PushAddress(address);
+  if (rules_.size() > 1) {
+    rule_ids_.push_back(rule);
+  }
+  CheckBudget();
+}
+
+void CandidateSet::PushValue(size_t address, const uint8_t *value) {
+  assert(value_size_ != 0);
+  PushAddress(address);
+  values_.Append(value, value_size_);
+  CheckBudget();
+}
+
+void CandidateSet::Push(size_t address, const ChangeString &change_str) {
+  if (value_size_ != 0) {
+    if (change_str.GetType() == rules_[0].GetType() && change_str.Size() == value_size_ && !change_str.HasMask()) {
+      PushValue(address, change_str.GetRawValue().data());
+      return;
+    }
+    ToRules();
+  }
+  size_t rule = FindRule(change_str);
+  if (rule == rules_.size()) {
+    // diffの結果などを読み込むと、値の違うルールがアドレスの数だけできてしまう
+    bool same_type = rules_.size() >= MAX_RULES && !change_str.HasMask();
+    for (auto it = rules_.begin(); it != rules_.end() && same_type; it++) {
+      same_type = it->GetType() == change_str.GetType() && it->Size() == change_str.Size() && !it->HasMask();
+    }
+    if (same_type) {
+      ToValues();
+      PushValue(address, change_str.GetRawValue().data());
+      return;
+    }
+    rules_.push_back(change_str);
+    if (rules_.size() == 2) {
+      rule_ids_.resize(Size(), 0);
+    }
+  }
+  Push(address, rule);
+}
+
+void CandidateSet::PushFrom(const CandidateSet &src, size_t index, size_t address) {
+  if (value_size_ != 0) {
+    PushValue(address, src.GetValue(index));
+  } else {
+    Push(address, src.rule_ids_.empty() ? 0 : src.rule_ids_[index]);
+  }
+}
+
+void CandidateSet::Append(const CandidateSet &other) {
+  assert(rules_.size() == other.rules_.size() && value_size_ == other.value_size_);
+  for (auto it = other.begin(); it != other.end(); ++it) {
+    PushAddress(it->address);
+    CheckBudget();
+  }
+  rule_ids_.Append(other.rule_ids_);
+  values_.Append(other.values_);
+}
+
+ChangeString CandidateSet::GetChangeString(size_t index) const {
+  if (value_size_ != 0) {
+    return ChangeString(rules_[0].GetType(), Converter::RawByteToByte(GetValue(index), value_size_));
+  }
+  return GetRule(index);
+}
+
+std::string CandidateSet::GetValueString(size_t index) const {
+  if (value_size_ != 0) {
+    return Converter::GetString(rules_[0].GetType(), Converter::RawByteToByte(GetValue(index), value_size_));
+  }
+  return GetRule(index).GetValue();
+}
+
+size_t CandidateSet::FindRule(const ChangeString &change_str) const {
+  for (size_t i = 0; i < rules_.size(); i++) {
+    const ChangeString &rule = rules_[i];
+    if (rule.GetType() == change_str.GetType() && rule.GetRawValue() == change_str.GetRawValue() &&
+        rule.GetMask() == change_str.GetMask()) {
+      return i;
+    }
+  }
+  return rules_.size();
+}
+
+/**
+ * ルールの値をアドレス毎の値に展開する、全てのルールが同じ型で同じ大きさであること
+ */
+void CandidateSet::ToValues() {
+  const Converter::Type type = rules_[0].GetType();
+  const size_t size = rules_[0].Size();
+  values_.clear();
+  for (size_t i = 0; i < Size(); i++) {
+    values_.Append(GetRule(i).GetRawValue().data(), size);
+  }
+  rules_.assign(1, ChangeString(type, std::vector<uint8_t>(size, 0)));
+  rule_ids_.clear();
+  value_size_ = size;
+}
+
+/**
+ * アドレス毎の値をルールに戻す、違う型を混ぜて読み込んだ場合だけ使う
+ */
+void CandidateSet::ToRules() {
+  const Converter::Type type = rules_[0].GetType();
+  const size_t size = value_size_;
+  const SpillArray<uint8_t> values = std::move(values_);
+  value_size_ = 0;
+  rules_.clear();
+  std::vector<uint32_t> rule_ids;
+  rule_ids.reserve(Size());
+  for (size_t i = 0; i < Size(); i++) {
+    ChangeString change_str(type, Converter::RawByteToByte(&values[i * size], size));
+    size_t rule = FindRule(change_str);
+    if (rule == rules_.size()) {
+      rules_.push_back(change_str);
+    }
+    rule_ids.push_back(rule);
+  }
+  rule_ids_.clear();
+  if (rules_.size() > 1) {
+    rule_ids_.Append(rule_ids.data(), rule_ids.size());
+  }
+}
+
+void CandidateSet::Serialize(FILE *fp) const {
+  fprintf(fp, "_%zd", Size());
+  for (auto it = begin(); it != end(); ++it) {
+    Address(it->address).Serialize(fp);
+    if (value_size_ != 0) {
+      GetChangeString(it->index).Serialize(fp);
+    } else {
+      GetRule(it->index).Serialize(fp);
+    }
+  }
+}
+
+void CandidateSet::DeSerialize(FILE *fp) {
+  Clear();
+  size_t length;
+  fscanf(fp, "_%zd", &length);
+  for (size_t i = 0; i < length; i++) {
+    Address address = Address::DeSerialize(fp);
+    ChangeString change_str = ChangeString::DeSerialize(fp);
+    Push(address.to_i(), change_str);
+  }
+  Shrink();
+}
+
+void CandidateMerger::Done(size_t i) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  done_[i] = true;
+  if (count_only_) {
+    // 数えるだけなら順番は関係ない
+    total_ += counts_[i];
+    full_ = total_ >= limit_;
+    return;
+  }
+  for (; next_ < parts_.size() && done_[next_]; next_++) {
+    const CandidateSet &part = parts_[next_];
+    if (part.Size() <= limit_ - target_.Size()) {
+      target_.Append(part);
+    } else {
+      for (auto it = part.begin(); it != part.end() && target_.Size() < limit_; ++it) {
+        target_.PushFrom(part, it->index, it->address);
+      }
+    }
+    parts_[next_] = CandidateSet();
+  }
+  full_ = target_.Size() >= limit_;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Address.h"
+#include "ChangeString.h"
+#include "SpillFile.h"
+
+/**
+ * lookup, filterで見つかったアドレスの集合
+ * TargetAddressを並べるとアドレス毎にChangeStringのヒープ確保が必要になるので、列毎に分けて持つ
+ * - アドレスは、同じ基準アドレスから4GB以内に続く区間毎に、基準からの32ビットのオフセットで持つ
+ *   0や-1のように多くのアドレスで見つかる区間は、オフセットを並べる代わりにビットマップで持つ
+ * - ルール(型と値)は集合に1つだけ持ち、複数ある場合(multi_lookup, any)だけアドレス毎にルールの番号を持つ
+ * - diff, lookup_ifのようにアドレス毎に値が違う場合だけ、アドレス毎に値を持つ
+ * アドレスの昇順に追加することを想定している
+ * メモリ上の大きさがbudgetを超えたら、閉じた区間から順にSpillFileに書き出してmmapで読む
+ */
+class CandidateSet {
+public:
+  // 1つの候補、indexで値や型を引く
+  struct Candidate {
+    size_t index;
+    size_t address;
+  };
+
+  class const_iterator {
+  public:
+    const Candidate &operator*() const { return current_; }
+    const Candidate *operator->() const { return &current_; }
+    const_iterator &operator++();
+    bool operator==(const const_iterator &rhs) const { return current_.index == rhs.current_.index; }
+    bool operator!=(const const_iterator &rhs) const { return current_.index != rhs.current_.index; }
+
+  private:
+    friend class CandidateSet;
+    const_iterator(const CandidateSet *set, size_t region, size_t index);
+    void Load(); // current_.indexの位置をregion_から読み込む
+    const CandidateSet *set_;
+    size_t region_;
+    size_t pos_;   // オフセットの配列かビットマップの中の位置
+    uint64_t bits_; // ビットマップの場合、pos_の語のまだ返していないビット
+    Candidate current_;
+  };
+
+  CandidateSet()
+      : count_(0), last_address_(0), open_or_(0), open_unique_(true), value_size_(0), budget_(0),
+        spill_failed_(false) {
+    ;
+  }
+
+  // 空にして、全てのアドレスがchange_strのルールを持つようにする
+  void Reset(const ChangeString &change_str);
+  // 空にして、アドレス毎にrulesのどれかを持つようにする
+  void Reset(const std::vector<ChangeString> &rules);
+  // 空にして、アドレス毎にtype型のsizeバイトの値を持つようにする
+  void ResetValues(const Converter::Type &type, size_t size);
+  // 同じルールや型を持つ空の集合、budgetは引き継がない
+  CandidateSet EmptyCopy() const;
+  // 0なら全てメモリ上に持つ
+  void SetBudget(size_t budget) { budget_ = budget; }
+  size_t GetBudget() const { return budget_; }
+  void Clear() { Reset(std::vector<ChangeString>()); }
+
+  // ルールが1つの場合
+  void Push(size_t address) { Push(address, 0); }
+  // ruleはResetで渡したrulesの番号
+  void Push(size_t address, size_t rule);
+  void PushValue(size_t address, const uint8_t *value);
+  // 必要なら値やルールの持ち方を変えて追加する、Loadなどで使う
+  void Push(size_t address, const ChangeString &change_str);
+  // 同じルールや型を持つsrcのindex番目を追加する
+  void PushFrom(const CandidateSet &src, size_t index, size_t address);
+  // 同じルールや型を持つotherを後ろに繋げる
+  void Append(const CandidateSet &other);
+  // 最後の区間も密度を見て持ち方を決める、追加し終わったら呼ぶ
+  void Shrink();
+
+  size_t Size() const { return count_; }
+  bool Empty() const { return count_ == 0; }
+  const_iterator begin() const { return At(0); }
+  const_iterator end() const { return const_iterator(this, regions_.size(), Size()); }
+  const_iterator At(size_t index) const;
+
+  size_t GetAddress(size_t index) const { return At(index)->address; }
+  const ChangeString &GetRule(size_t index) const { return rules_[rule_ids_.empty() ? 0 : rule_ids_[index]]; }
+  Converter::Type GetType(size_t index) const { return GetRule(index).GetType(); }
+  size_t GetSize(size_t index) const { return value_size_ != 0 ? value_size_ : GetRule(index).Size(); }
+  const uint8_t *GetValue(size_t index) const {
+    return value_size_ != 0 ? &values_[index * value_size_] : GetRule(index).GetRawValue().data();
+  }
+  // 表示や書き出しの時だけ使う
+  ChangeString GetChangeString(size_t index) const;
+  std::string GetValueString(size_t index) const;
+
+  // メモリ上に持っているバイト数と、ファイルに書き出したバイト数と、ビットマップで持っている区間の数
+  size_t GetMemorySize() const {
+    return regions_.size() * sizeof(Region) + offsets_.GetMemorySize() + bitmaps_.GetMemorySize() +
+           rule_ids_.GetMemorySize() + values_.GetMemorySize();
+  }
+  size_t GetSpilledSize() const {
+    return offsets_.GetSpilledSize() * sizeof(uint32_t) + bitmaps_.GetSpilledSize() * sizeof(uint64_t) +
+           rule_ids_.GetSpilledSize() * sizeof(uint32_t) + values_.GetSpilledSize();
+  }
+  size_t GetBitmapRegionCount() const;
+
+  // TargetAddressの並びと同じ形式で読み書きする
+  void Serialize(FILE *fp) const;
+  void DeSerialize(FILE *fp);
+
+private:
+  // [begin, end)番目のアドレス
+  // 配列の場合は base + offsets_[data + i - begin]
+  // ビットマップの場合は、bitmaps_[data]から続くwords語のk番目のビットが base + (k << shift) を表す
+  struct Region {
+    size_t base;
+    size_t begin;
+    size_t end;
+    size_t data;
+    size_t words;
+    int shift;
+    bool bitmap;
+  };
+
+  // これより多くの値が違うルールを読み込んだら、アドレス毎に値を持つ形に変える
+  static const size_t MAX_RULES = 64;
+  // 前のアドレスからこれ以上離れていたら区間を分ける、ビットマップが隙間で大きくならないように
+  static const size_t MAX_GAP = 64 * 1024;
+  // 配列の区間にこの数だけ追加する毎に、ビットマップにした方が小さいかを調べる
+  // 全体でもこの数だけ追加する毎に、budgetを超えていないかを調べる
+  static const size_t CHECK_INTERVAL = 4096;
+  // 1つの区間の大きさの上限、書き出せるのは閉じた区間だけなので大きくなりすぎないようにする
+  static const size_t MAX_REGION_BYTES = 8 * 1024 * 1024;
+
+  void PushAddress(size_t address);
+  void ChooseRepresentation(bool growing);
+  void ToBitmap();
+  void ToArray();
+  void CheckBudget();
+  size_t FindRule(const ChangeString &change_str) const;
+  void ToValues();
+  void ToRules();
+
+  std::vector<Region> regions_;
+  SpillArray<uint32_t> offsets_;
+  SpillArray<uint64_t> bitmaps_;
+  size_t count_;
+  size_t last_address_;
+  uint32_t open_or_;  // 最後の区間のオフセットのOR、ビットマップの間隔を決める
+  bool open_unique_;  // 最後の区間に同じアドレスが無い
+  std::vector<ChangeString> rules_;
+  SpillArray<uint32_t> rule_ids_; // ルールが1つなら空
+  SpillArray<uint8_t> values_;    // value_size_バイトずつ、アドレス毎に値を持たないなら空
+  size_t value_size_;             // 0ならルールの値を使う
+  size_t budget_;
+  bool spill_failed_; // 書き出せなかったら、それ以降はメモリ上に持つ
+};
+
+/**
+ * 並列に作った部分集合を、番号の順にtargetの後ろに繋げる
+ * 全て揃うのを待たずに、前から続けて終わったものから繋げて解放するので、targetのbudgetが効く
+ * limitを渡すと先頭からlimit個だけを残し、揃った時点でFullになる
+ * count_onlyの場合は部分集合を作らずにCountで数だけを受け取り、targetは変えない
+ */
+class CandidateMerger {
+public:
+  CandidateMerger(CandidateSet &target, size_t parts, size_t limit = SIZE_MAX, bool count_only = false)
+      : target_(target), parts_(count_only ? 0 : parts, target.EmptyCopy()), done_(parts, false), counts_(parts, 0),
+        next_(0), total_(0), limit_(limit), count_only_(count_only), full_(false) {
+    ;
+  }
+  // i番目の部分集合、Doneを呼ぶまでは呼び出したスレッドだけが触って良い
+  CandidateSet &Part(size_t i) { return parts_[i]; }
+  // i番目の部分集合にこれ以上追加しても使われない
+  bool Enough(size_t i) const { return !count_only_ && parts_[i].Size() >= limit_; }
+  void Count(size_t i, size_t n) { counts_[i] += n; }
+  void Done(size_t i);
+  // 前から続けて繋げたものがlimitに達した、残りの部分集合は作らなくて良い
+  bool Full() const { return full_; }
+  // 全てDoneを呼んだ後に呼ぶ
+  void Finish() {
+    if (!count_only_) {
+      target_.Shrink();
+    }
+  }
+  bool IsCountOnly() const { return count_only_; }
+  // count_onlyの場合、i番目で数えた数と、Doneを呼んだものの合計
+  size_t GetCount(size_t i) const { return counts_[i]; }
+  size_t GetTotal() const { return total_; }
+
+private:
+  CandidateSet &target_;
+  std::vector<CandidateSet> parts_;
+  std::vector<bool> done_;
+  std::vector<size_t> counts_;
+  size_t next_;
+  size_t total_;
+  size_t limit_;
+  bool count_only_;
+  std::atomic<bool> full_;
+  std::mutex mutex_;
+};
@@ -16,6 +16,10 @@
  */
 #include <algorithm>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ChangeString.h"
 #include "Utility.h"
@@ -32,6 +36,10 @@ ChangeString::ChangeString(const std::string &type, const std::string &value) {
 
 bool ChangeString::Init(const std::string &type, const std::string &value) {
   type_ = Converter::GetType(type);
+  mask_.clear();
+  if (type_ == Converter::Type::AOB) {
+    return Converter::AobToByte(value, value_, mask_);
+  }
   value_ = Converter::GetByte(type_, value);
   if (type_ == Converter::Type::INVALID) {
     return false;
@@ -39,6 +47,18 @@ bool ChangeString::Init(const std::string &type, const std::string &value) {
   return true;
 }
 
+bool ChangeString::Match(const uint8_t *memory) const {
+  if (!HasMask()) {
+    return memcmp(memory, value_.data(), value_.size()) == 0;
+  }
+  for (size_t i = 0; i < value_.size(); i++) {
+    if ((memory[i] & mask_[i]) != value_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool ChangeString::Init(int value) {
   type_ = Converter::Type::INT_LITTLE_ENDIAN;
   value_ = Converter::IntToByte(value);
@@ -48,10 +68,59 @@ bool ChangeString::Init(int value) {
 void ChangeString::Serialize(FILE *fp) const {
   Utility::StringSerialize(fp, GetTypeString());
   Utility::ByteSerialize(fp, value_);
+  // 他の型の形式は変えずに、aobだけマスクを続けて書く
+  if (type_ == Converter::Type::AOB) {
+    Utility::ByteSerialize(fp, mask_);
+  }
 }
 
 ChangeString ChangeString::DeSerialize(FILE *fp) {
   std::string type = Utility::StringDeSerialize(fp);
   std::vector<uint8_t> value = Utility::ByteDeSerialize(fp);
+  if (Converter::GetType(type) == Converter::Type::AOB) {
+    std::vector<uint8_t> mask = Utility::ByteDeSerialize(fp);
+    return ChangeString(Converter::GetType(type), value, mask);
+  }
   return ChangeString(Converter::GetType(type), value);
 }
+
+std::vector<ChangeString> ChangeString::GetAnyRepresentations(const std::string &value) {
+  std::vector<ChangeString> ret;
+  if (value.empty()) {
+    return ret;
+  }
+  char *end = nullptr;
+  errno = 0;
+  strtod(value.c_str(), &end);
+  if (errno != 0 || *end != '\0') {
+    return ret;
+  }
+  std::vector<Converter::Type> types;
+  // 整数として読めない値は、整数型では表せない
+  errno = 0;
+  long v = strtol(value.c_str(), &end, 10);
+  if (errno == 0 && *end == '\0') {
+    if (INT_MIN <= v && v <= INT_MAX) {
+      types.push_back(Converter::Type::INT_LITTLE_ENDIAN);
+      types.push_back(Converter::Type::INT_BIG_ENDIAN);
+    }
+    types.push_back(Converter::Type::LONG_LITTLE_ENDIAN);
+    types.push_back(Converter::Type::LONG_BIG_ENDIAN);
+  }
+  types.push_back(Converter::Type::FLOAT_LITTLE_ENDIAN);
+  types.push_back(Converter::Type::FLOAT_BIG_ENDIAN);
+  types.push_back(Converter::Type::DOUBLE_LITTLE_ENDIAN);
+  types.push_back(Converter::Type::DOUBLE_BIG_ENDIAN);
+  types.push_back(Converter::Type::ASCII);
+  types.push_back(Converter::Type::UTF16);
+
+  // 同じバイト列になる型は最初のものだけを残す (e.g. 0はintでもfloatでも00000000)
+  std::set<std::vector<uint8_t>> seen;
+  for (auto it = types.begin(); it != types.end(); it++) {
+    std::vector<uint8_t> byte = Converter::GetByte(*it, value);
+    if (seen.insert(byte).second) {
+      ret.emplace_back(*it, byte);
+    }
+  }
+  return ret;
+}
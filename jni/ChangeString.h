@@ -19,6 +19,7 @@
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "Converter.h"
 
@@ -26,17 +27,34 @@ class ChangeString {
 public:
   ChangeString() : type_(Converter::Type::INVALID) { ; }
   ChangeString(const Converter::Type &type, const std::vector<uint8_t> &value) : type_(type), value_(value) { ; }
+  ChangeString(const Converter::Type &type, const std::vector<uint8_t> &value, const std::vector<uint8_t> &mask)
+      : type_(type), value_(value), mask_(mask) {
+    ;
+  }
   ChangeString(const std::string &type, const std::string &value);
   ChangeString(int value) { Init(value); }
   bool Init(const std::string &type, const std::string &value);
   bool Init(int value);
+  // 数値を表すと考えられる全ての型 (int, long, float, doubleとそのbig endian, ascii, utf16) に変換する
+  static std::vector<ChangeString> GetAnyRepresentations(const std::string &value);
   virtual ~ChangeString() { ; }
   const std::vector<uint8_t> &GetRawValue() const { return value_; }
+  // 比較に使うビットのマスク、空なら全てのビットを比較する
+  const std::vector<uint8_t> &GetMask() const { return mask_; }
+  bool HasMask() const { return !mask_.empty(); }
   std::string GetHexValue() const { return Converter::ByteToHex(value_); }
-  std::string GetValue() const { return Converter::GetString(type_, value_); }
+  std::string GetValue() const {
+    return HasMask() ? Converter::ByteToAob(value_, mask_) : Converter::GetString(type_, value_);
+  }
+  // memoryのSize()バイトがマスクを考慮して一致するか
+  bool Match(const uint8_t *memory) const;
 
   size_t Size() const { return value_.size(); }
   const Converter::Type GetType() const { return type_; }
+  // 値そのものではなく、値の近くの範囲を探す型か
+  bool IsFuzzy() const {
+    return type_ == Converter::Type::FLOAT_FUZZY_LITTLE_ENDIAN || type_ == Converter::Type::DOUBLE_FUZZY_LITTLE_ENDIAN;
+  }
   const std::string GetTypeString() const { return Converter::GetTypeString(type_); }
 
   static void PrintCommandUsage() {
@@ -54,6 +72,15 @@ public:
     fprintf(stderr, "  float [value]\n");
     fprintf(stderr, "  float_big [value]\n");
     fprintf(stderr, "  float_fuzzy [value]\n");
+    fprintf(stderr, "  double_fuzzy [value]\n");
+    fprintf(stderr, "  int8 [value]\n");
+    fprintf(stderr, "  int16 [value]\n");
+    fprintf(stderr, "  uint8 [value]\n");
+    fprintf(stderr, "  uint16 [value]\n");
+    fprintf(stderr, "  uint [value]\n");
+    fprintf(stderr, "  ulong [value]\n");
+    fprintf(stderr, "  any [value]              (lookup, filter only) all representations of the number\n");
+    fprintf(stderr, "  aob [value]              (lookup, filter only) hex with ?? wildcard (e.g. aob 8b 45 ?? 89)\n");
   }
 
   bool operator<(const ChangeString &rhs) const { return value_ < rhs.value_; }
@@ -69,6 +96,7 @@ private:
   Converter::Type type_;
   std::vector<uint8_t> value_; // lookup, filter,
                                // changeなどの処理が終わった後にメモリに入っている値
+  std::vector<uint8_t> mask_;  // aobの?の部分が0になる
 
   std::string GetString(const std::string &str) const;
 };
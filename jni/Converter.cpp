@@ -16,7 +16,9 @@
  */
 #include <algorithm>
 #include <assert.h>
+#include <ctype.h>
 #include <map>
+#include <sstream>
 
 #include "Converter.h"
 #include "Utility.h"
@@ -37,6 +39,14 @@ Type GetType(const std::string &str) {
       {"float", Type::FLOAT_LITTLE_ENDIAN},
       {"float_big", Type::FLOAT_BIG_ENDIAN},
       {"float_fuzzy", Type::FLOAT_FUZZY_LITTLE_ENDIAN},
+      {"int8", Type::INT8},
+      {"int16", Type::INT16_LITTLE_ENDIAN},
+      {"uint8", Type::UINT8},
+      {"uint16", Type::UINT16_LITTLE_ENDIAN},
+      {"uint", Type::UINT_LITTLE_ENDIAN},
+      {"ulong", Type::ULONG_LITTLE_ENDIAN},
+      {"double_fuzzy", Type::DOUBLE_FUZZY_LITTLE_ENDIAN},
+      {"aob", Type::AOB},
   };
   if (!temp.count(str)) {
     return Type::INVALID;
@@ -58,6 +68,14 @@ std::string GetTypeString(const Type &type) {
       {Type::FLOAT_LITTLE_ENDIAN, "float"},
       {Type::FLOAT_BIG_ENDIAN, "float_big"},
       {Type::FLOAT_FUZZY_LITTLE_ENDIAN, "float_fuzzy"},
+      {Type::INT8, "int8"},
+      {Type::INT16_LITTLE_ENDIAN, "int16"},
+      {Type::UINT8, "uint8"},
+      {Type::UINT16_LITTLE_ENDIAN, "uint16"},
+      {Type::UINT_LITTLE_ENDIAN, "uint"},
+      {Type::ULONG_LITTLE_ENDIAN, "ulong"},
+      {Type::DOUBLE_FUZZY_LITTLE_ENDIAN, "double_fuzzy"},
+      {Type::AOB, "aob"},
   };
   if (!temp.count(type)) {
     return "INVALID";
@@ -73,6 +91,7 @@ std::string GetString(const Type &type, const std::vector<uint8_t> &byte) {
   case Type::UTF32:
     return Utf32ToAscii(byte);
   case Type::HEX:
+  case Type::AOB:
     return ByteToHex(byte);
   case Type::INT_LITTLE_ENDIAN:
     return ByteToIntstr(byte);
@@ -104,6 +123,15 @@ std::string GetString(const Type &type, const std::vector<uint8_t> &byte) {
   }
   case Type::FLOAT_FUZZY_LITTLE_ENDIAN:
     return ByteToFloatstr(byte);
+  case Type::DOUBLE_FUZZY_LITTLE_ENDIAN:
+    return ByteToDoublestr(byte);
+  case Type::INT8:
+  case Type::INT16_LITTLE_ENDIAN:
+  case Type::UINT8:
+  case Type::UINT16_LITTLE_ENDIAN:
+  case Type::UINT_LITTLE_ENDIAN:
+  case Type::ULONG_LITTLE_ENDIAN:
+    return ByteToIntegerstr(type, byte);
   default:
     assert(false);
   }
@@ -149,6 +177,27 @@ std::vector<uint8_t> GetByte(const Type &type, const std::string &str) {
   }
   case Type::FLOAT_FUZZY_LITTLE_ENDIAN:
     return FloatToByte(atof(str.c_str()));
+  case Type::DOUBLE_FUZZY_LITTLE_ENDIAN:
+    return DoubleToByte(atof(str.c_str()));
+  case Type::AOB: {
+    std::vector<uint8_t> ret, mask;
+    if (!AobToByte(str, ret, mask)) {
+      return std::vector<uint8_t>();
+    }
+    return ret;
+  }
+  case Type::INT8:
+    return Int8ToByte(atoi(str.c_str()));
+  case Type::INT16_LITTLE_ENDIAN:
+    return Int16ToByte(atoi(str.c_str()));
+  case Type::UINT8:
+    return Uint8ToByte(strtoul(str.c_str(), nullptr, 10));
+  case Type::UINT16_LITTLE_ENDIAN:
+    return Uint16ToByte(strtoul(str.c_str(), nullptr, 10));
+  case Type::UINT_LITTLE_ENDIAN:
+    return UintToByte(strtoul(str.c_str(), nullptr, 10));
+  case Type::ULONG_LITTLE_ENDIAN:
+    return UlongToByte(strtoul(str.c_str(), nullptr, 10));
   default:
     break;
   }
@@ -198,6 +247,63 @@ std::string ByteToHex(const std::vector<uint8_t> &byte) {
   return ret;
 }
 
+bool AobToByte(const std::string &aob, std::vector<uint8_t> &byte, std::vector<uint8_t> &mask) {
+  byte.clear();
+  mask.clear();
+  std::stringstream ss(aob);
+  std::string token;
+  while (ss >> token) {
+    // ?と??は1バイト全体、2文字の場合は1文字ずつ?にできる
+    if (token == "?" || token == "??") {
+      byte.emplace_back(0);
+      mask.emplace_back(0);
+      continue;
+    }
+    if (token.size() != 2) {
+      Utility::DebugLog("'%s' is not aob string", aob.c_str());
+      return false;
+    }
+    int v = 0;
+    int m = 0;
+    for (auto it = token.begin(); it != token.end(); it++) {
+      int c = tolower(*it);
+      if (c == '?') {
+        v = v * 16;
+        m = m * 16;
+      } else if (isxdigit(c)) {
+        v = v * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+        m = m * 16 + 0xf;
+      } else {
+        Utility::DebugLog("'%s' is not aob string", aob.c_str());
+        return false;
+      }
+    }
+    byte.emplace_back(v);
+    mask.emplace_back(m);
+  }
+  if (byte.empty()) {
+    Utility::DebugLog("'%s' is not aob string", aob.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string ByteToAob(const std::vector<uint8_t> &byte, const std::vector<uint8_t> &mask) {
+  std::string ret;
+  for (size_t i = 0; i < byte.size(); i++) {
+    if (i > 0) {
+      ret.push_back(' ');
+    }
+    int vs[2] = {byte[i] / 16, byte[i] % 16};
+    int ms[2] = {mask[i] / 16, mask[i] % 16};
+    for (int j = 0; j < 2; j++) {
+      int c = ms[j] == 0 ? '?' : (vs[j] < 10 ? vs[j] + '0' : vs[j] + 'a' - 10);
+      ret.push_back(c);
+    }
+  }
+  return ret;
+}
+
 // little endianで返す
 std::vector<uint8_t> IntToByte(int v) { return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + 4); }
 
@@ -314,6 +420,48 @@ std::string ByteToFloatstr(const std::vector<uint8_t> &byte) {
   return ret;
 }
 
+// little endianで返す
+std::vector<uint8_t> Int8ToByte(int8_t v) { return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + sizeof(v)); }
+std::vector<uint8_t> Int16ToByte(int16_t v) { return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + sizeof(v)); }
+std::vector<uint8_t> Uint8ToByte(uint8_t v) { return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + sizeof(v)); }
+std::vector<uint8_t> Uint16ToByte(uint16_t v) {
+  return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + sizeof(v));
+}
+std::vector<uint8_t> UintToByte(uint32_t v) { return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + sizeof(v)); }
+std::vector<uint8_t> UlongToByte(unsigned long v) {
+  return std::vector<uint8_t>((uint8_t *)&v, ((uint8_t *)&v) + sizeof(v));
+}
+
+// little endianを想定
+std::string ByteToIntegerstr(const Type &type, const std::vector<uint8_t> &byte) {
+  char str[30];
+  switch (type) {
+  case Type::INT8:
+    snprintf(str, 29, "%d", (int)*(int8_t *)byte.data());
+    break;
+  case Type::INT16_LITTLE_ENDIAN:
+    snprintf(str, 29, "%d", (int)*(int16_t *)byte.data());
+    break;
+  case Type::UINT8:
+    snprintf(str, 29, "%u", (unsigned int)*(uint8_t *)byte.data());
+    break;
+  case Type::UINT16_LITTLE_ENDIAN:
+    snprintf(str, 29, "%u", (unsigned int)*(uint16_t *)byte.data());
+    break;
+  case Type::UINT_LITTLE_ENDIAN:
+    snprintf(str, 29, "%u", *(uint32_t *)byte.data());
+    break;
+  case Type::ULONG_LITTLE_ENDIAN:
+    snprintf(str, 29, "%lu", *(unsigned long *)byte.data());
+    break;
+  default:
+    assert(false);
+    return "INVALID_TYPE";
+  }
+  std::string ret = str;
+  return ret;
+}
+
 // big endianを想定
 std::vector<uint8_t> AsciiToUtf16(const std::string &str) {
   std::vector<uint8_t> ret;
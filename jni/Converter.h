@@ -35,6 +35,14 @@ enum class Type {
   FLOAT_LITTLE_ENDIAN,
   FLOAT_BIG_ENDIAN,
   FLOAT_FUZZY_LITTLE_ENDIAN,
+  INT8,
+  INT16_LITTLE_ENDIAN,
+  UINT8,
+  UINT16_LITTLE_ENDIAN,
+  UINT_LITTLE_ENDIAN,
+  ULONG_LITTLE_ENDIAN,
+  DOUBLE_FUZZY_LITTLE_ENDIAN,
+  AOB,
   INVALID,
 };
 Type GetType(const std::string &str);
@@ -49,6 +57,12 @@ std::string ByteToAscii(const std::vector<uint8_t> &byte);
 std::vector<uint8_t> HexToByte(const std::string &hex);
 std::string ByteToHex(const std::vector<uint8_t> &byte);
 
+// 空白で区切った1バイトずつの16進数 (e.g. 8b 45 ?? 89, 4?)、?の部分は値もマスクも0になる
+// ?か??だけのトークンは1バイト全体を表す
+// 解釈できなければfalseを返す
+bool AobToByte(const std::string &aob, std::vector<uint8_t> &byte, std::vector<uint8_t> &mask);
+std::string ByteToAob(const std::vector<uint8_t> &byte, const std::vector<uint8_t> &mask);
+
 // little endianで返す
 std::vector<uint8_t> IntToByte(int v);
 int ByteToInt(const std::vector<uint8_t> &byte);
@@ -70,6 +84,15 @@ std::vector<uint8_t> FloatToByte(float v);
 float ByteToFloat(const std::vector<uint8_t> &byte);
 std::string ByteToFloatstr(const std::vector<uint8_t> &byte);
 
+// int, long以外の幅の整数、little endianを想定
+std::vector<uint8_t> Int8ToByte(int8_t v);
+std::vector<uint8_t> Int16ToByte(int16_t v);
+std::vector<uint8_t> Uint8ToByte(uint8_t v);
+std::vector<uint8_t> Uint16ToByte(uint16_t v);
+std::vector<uint8_t> UintToByte(uint32_t v);
+std::vector<uint8_t> UlongToByte(unsigned long v);
+std::string ByteToIntegerstr(const Type &type, const std::vector<uint8_t> &byte);
+
 // big endianを想定
 std::vector<uint8_t> AsciiToUtf16(const std::string &str);
 std::string Utf16ToAscii(const std::vector<uint8_t> &byte);
@@ -37,6 +37,11 @@ void LineReader::InitCommandMap() {
   commands["clear"] = &Patcher::Clear;
   commands["lookup"] = &Patcher::Process;
   commands["filter"] = &Patcher::Process;
+  commands["lookup_if"] = &Patcher::ProcessIf;
+  commands["filter_if"] = &Patcher::ProcessIf;
+  commands["count"] = &Patcher::Process;
+  commands["count_if"] = &Patcher::ProcessIf;
+  commands["multi_lookup"] = &Patcher::MultiLookUp;
   commands["pair_filter"] = &Patcher::PairFilter;
   commands["change"] = &Patcher::Process;
   commands["replace"] = &Patcher::Replace;
@@ -45,6 +50,7 @@ void LineReader::InitCommandMap() {
   commands["diff"] = &Patcher::Diff;
 
   commands["scope"] = &Patcher::Scope;
+  commands["set"] = &Patcher::Set;
   commands["save"] = &Patcher::Save;
   commands["load"] = &Patcher::Load;
   commands["result"] = &Patcher::Result;
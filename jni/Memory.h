@@ -16,21 +16,38 @@
  */
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <stdint.h>
+#include <vector>
 
 #include "Address.h"
+#include "ReadCache.h"
+
+class FileDescriptor;
+
+// ReadVector, WriteVectorでまとめて読み書きする1アドレス分のリクエスト
+struct IoRequest {
+  size_t address;
+  size_t size;
+  uint8_t *data;
+  bool done;
+};
 
 class Memory {
 public:
-  Memory() : pid_(-1), attached_(false) { ; }
-  explicit Memory(int pid, bool without_ptrace) : pid_(pid), attached_(false), without_ptrace_(without_ptrace) { ; }
+  Memory() : pid_(-1), attached_(false), use_process_vm_(true) { ; }
+  explicit Memory(int pid, bool without_ptrace)
+      : pid_(pid), attached_(false), without_ptrace_(without_ptrace), use_process_vm_(true) {
+    ;
+  }
   virtual ~Memory() {
     if (pid_ != -1) {
       Detach();
     }
-    cache_.reset();
   }
 
   int GetPid() const { return pid_; }
@@ -39,24 +56,64 @@ public:
   bool Detach();
   // size_t ReadByPeekData(uint8_t *dest, const Address &src) const;
   // size_t ReadByPeekData(uint8_t *dest, const Range &src) const;
-  size_t Read(uint8_t *dest, const Range &src) const;
+  // 読めないページがあっても読める部分は全て読み込み、読めない部分は0で埋める
+  // 読み込めたバイト数を返し、unreadableが指定されていれば読めなかった範囲をアドレス順に追加する
+  size_t Read(uint8_t *dest, const Range &src, std::vector<Range> *unreadable = nullptr) const;
   size_t ReadWithCache(uint8_t *dest, const Range &src, const Range &parent_range) const;
+  // 複数アドレスを少ないsyscallでまとめて読み込み、読み込めたリクエストの数を返す
+  size_t ReadVector(std::vector<IoRequest> &requests) const;
   size_t WriteByPokeData(const Address &dest, long value) const;
   size_t WriteByPokeData(const Range &dest, const uint8_t *src, bool freeze_request) const;
   size_t Write(const Range &dest, const uint8_t *src, bool freeze_request) const;
+  // 複数アドレスを少ないsyscallでまとめて書き込み、書き込めたリクエストの数を返す
+  size_t WriteVector(std::vector<IoRequest> &requests) const;
   void Dump(const Range &src) const;
   bool GenerateMaps(std::stringstream &ss);
+  // /proc/pid/maps形式の内容をmapsに読み込む、mapsの領域は使い回す
+  bool ReadMaps(std::string &maps);
+  // マッピングが変わった範囲について、キャッシュと読めなかったページの記録を捨てる
+  void InvalidateMapping(const Range &range);
+  // rangeの中で実際にデータを持っているページの範囲をresidentに追加する
+  // 一度も触られていない匿名ページと共有ゼロページのページは除く
+  // 判定できない場合はrange全体を追加してfalseを返す
+  bool GetResidentRanges(const Range &range, std::vector<Range> &resident) const;
+  // soft-dirtyビットを消して、これ以降に書き込まれたページを追跡する
+  // カーネルが対応していない場合はfalseを返す
+  bool ClearSoftDirty() const;
+  // rangeの中でClearSoftDirtyの後に書き込まれたページの範囲をdirtyに追加する
+  bool GetDirtyRanges(const Range &range, std::vector<Range> &dirty) const;
+
+  void SetCacheBudget(size_t budget) { cache_.SetBudget(budget); }
+  const ReadCache &GetCache() const { return cache_; }
 
 private:
   int pid_;
   bool attached_;
   bool without_ptrace_;
   std::set<int> thread_ids_;
+  // process_vm_readvがカーネルに拒否された場合はfalseになる
+  mutable std::atomic<bool> use_process_vm_;
+
+  // Attachした際に/proc/[pid]/memを開いておき、Detachするまで使い回す
+  // FreezeThreadと共有するので、参照中に閉じられないようshared_ptrで持つ
+  std::shared_ptr<const FileDescriptor> read_fd_;
+  std::shared_ptr<const FileDescriptor> write_fd_;
+  std::shared_ptr<const FileDescriptor> pagemap_fd_;
 
   // cacheはAttachした際にclearされる
-  mutable Range cache_range_;
-  mutable std::unique_ptr<uint8_t[]> cache_;
+  mutable ReadCache cache_;
 
   void LoadThreadIDs();
   void ClearCache();
+  void OpenFileDescriptors();
+  void CloseFileDescriptors();
+
+  // 読めなかったページの範囲 (start -> end)
+  // 一度読めなかったページはDetachするまでsyscallせずに読み飛ばす
+  mutable std::mutex unreadable_mutex_;
+  mutable std::map<size_t, size_t> unreadable_pages_;
+  size_t ReadSpan(int fd, uint8_t *dest, size_t start, size_t end, std::vector<Range> &unreadable) const;
+  void AddUnreadablePage(size_t start, size_t end) const;
+  std::vector<Range> GetUnreadablePages(size_t start, size_t end) const;
+  void ClearUnreadablePages();
 };
@@ -54,30 +54,37 @@ bool Memory::Detach() {
   return true;
 }
 
-size_t Memory::Read(uint8_t *dest, const Range &src) const {
+size_t Memory::Read(uint8_t *dest, const Range &src, std::vector<Range> *unreadable) const {
   assert(pid_ >= 0);
   assert(attached_);
   size_t n = src.Size();
   kern_return_t kr;
   mach_port_t task;
+  mach_vm_size_t out_size = 0;
 
   kr = task_for_pid(mach_task_self(), pid_, &task);
   if (kr != KERN_SUCCESS) {
     Utility::DebugLog("*** Error: task_for_pid failed ***\nPID: %d\n%s (errno=%d)\n", pid_, strerror(errno), errno);
-    return false;
-  }
-  mach_vm_size_t out_size;
-  kr = mach_vm_read_overwrite(task, src.GetStart().to_i(), n, (mach_vm_size_t)dest, &out_size);
-  if (kr != KERN_SUCCESS) {
-    Utility::DebugLog("*** Error : Memory Read is failed ***\nAddress: %zx\n%s (errno=%d)\n", src.GetStart().to_i(),
-                      strerror(errno), errno);
-    return 0;
-  } else if (out_size != n) {
-    Utility::DebugLog("*** Error : Memory Read is failed ***\nExpected length: "
-                      "%zu\nRead length: %zu\nAddress: %zx\n",
-                      n, out_size, src.GetStart().to_i());
+  } else {
+    kr = mach_vm_read_overwrite(task, src.GetStart().to_i(), n, (mach_vm_size_t)dest, &out_size);
+    if (kr != KERN_SUCCESS) {
+      Utility::DebugLog("*** Error : Memory Read is failed ***\nAddress: %zx\n%s (errno=%d)\n", src.GetStart().to_i(),
+                        strerror(errno), errno);
+      out_size = 0;
+    } else if (out_size != n) {
+      Utility::DebugLog("*** Error : Memory Read is failed ***\nExpected length: "
+                        "%zu\nRead length: %zu\nAddress: %zx\n",
+                        n, out_size, src.GetStart().to_i());
+    }
   }
 
+  // 読めなかった部分は0で埋める
+  if (out_size < n) {
+    memset(dest + out_size, 0, n - out_size);
+    if (unreadable != nullptr) {
+      unreadable->emplace_back(src.GetStart().to_i() + out_size, src.GetEnd().to_i(), src.GetComment());
+    }
+  }
   return out_size;
 }
 
@@ -85,17 +92,21 @@ size_t Memory::ReadWithCache(uint8_t *dest, const Range &src, const Range &paren
   assert(pid_ >= 0);
   assert(attached_);
   assert(parent_range.IsSuperset(src));
-  if (parent_range.GetStart().to_i() != cache_range_.GetStart().to_i() ||
-      parent_range.GetEnd().to_i() != cache_range_.GetEnd().to_i()) {
-    cache_range_ = parent_range;
-    cache_ = std::make_unique<uint8_t[]>(cache_range_.Size());
-    Read(cache_.get(), parent_range);
+  size_t ret = cache_.Read(dest, src, parent_range, [this](uint8_t *d, const Range &r) { return Read(d, r); });
+  // ブロックの途中に読めない部分があった場合は直接読み込む
+  if (ret != src.Size()) {
+    ret = Read(dest, src);
   }
+  return ret;
+}
 
-  size_t offset = src.GetStart().to_i() - cache_range_.GetStart().to_i();
-  memcpy(dest, cache_.get() + offset, src.Size());
-
-  return src.Size();
+size_t Memory::ReadVector(std::vector<IoRequest> &requests) const {
+  size_t cnt = 0;
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    it->done = Read(it->data, Range(it->address, it->address + it->size, "")) == it->size;
+    cnt += it->done;
+  }
+  return cnt;
 }
 
 size_t Memory::WriteByPokeData(const Address &dest, long value) const { return 0; }
@@ -103,6 +114,7 @@ size_t Memory::WriteByPokeData(const Address &dest, long value) const { return 0
 size_t Memory::WriteByPokeData(const Range &dest, const uint8_t *src, bool freeze_request) const { return 0; }
 
 size_t Memory::Write(const Range &dest, const uint8_t *src, bool freeze_request) const {
+  cache_.Invalidate(dest);
   assert(pid_ >= 0);
   assert(attached_ || freeze_request);
   mach_port_t task;
@@ -124,6 +136,15 @@ size_t Memory::Write(const Range &dest, const uint8_t *src, bool freeze_request)
   return n;
 }
 
+size_t Memory::WriteVector(std::vector<IoRequest> &requests) const {
+  size_t cnt = 0;
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    it->done = Write(Range(it->address, it->address + it->size, ""), it->data, false) == it->size;
+    cnt += it->done;
+  }
+  return cnt;
+}
+
 void Memory::Dump(const Range &src) const {
   assert(pid_ >= 0);
   assert(attached_);
@@ -133,18 +154,39 @@ void Memory::Dump(const Range &src) const {
     return;
   }
   const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
-  size_t l = Read(temp_p.get(), src);
+  // 近くのアドレスを続けてダンプすることが多いのでキャッシュ付きで読む
+  size_t l = ReadWithCache(temp_p.get(), src, Range(0, SIZE_MAX, ""));
   Utility::DebugLog("%s",
                     Utility::HexDump(src.GetStart().to_i(), src.GetComment().c_str(), temp_p.get(), l, 2).c_str());
 }
 
+bool Memory::GetResidentRanges(const Range &range, std::vector<Range> &resident) const {
+  resident.push_back(range);
+  return false;
+}
+
+bool Memory::ClearSoftDirty() const { return false; }
+
+bool Memory::GetDirtyRanges(const Range &range, std::vector<Range> &dirty) const {
+  dirty.push_back(range);
+  return false;
+}
+
 void Memory::LoadThreadIDs() {}
 
-void Memory::ClearCache() {
-  cache_range_ = Range();
-  cache_.reset();
+void Memory::ClearCache() { cache_.Clear(); }
+
+bool Memory::ReadMaps(std::string &maps) {
+  std::stringstream ss;
+  if (!GenerateMaps(ss)) {
+    return false;
+  }
+  maps = ss.str();
+  return true;
 }
 
+void Memory::InvalidateMapping(const Range &range) { cache_.Invalidate(range); }
+
 bool Memory::GenerateMaps(std::stringstream &ss) {
   assert(pid_ >= 0);
   mach_port_t task;
@@ -18,26 +18,61 @@
 
 #include "Memory.h"
 #include "Utility.h"
+#include <algorithm>
 #include <assert.h>
 #include <dirent.h> // opendir用
 #include <errno.h>
 #include <fcntl.h>
+#include <functional>
+#include <limits.h>
 #include <memory>
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+// /proc/[pid]以下のファイルのディスクリプタ
+// 最後の参照が外れた時にcloseする
+class FileDescriptor {
+public:
+  explicit FileDescriptor(int fd) : fd_(fd) { ; }
+  FileDescriptor(FileDescriptor const &) = delete;
+  FileDescriptor &operator=(FileDescriptor const &) = delete;
+  ~FileDescriptor() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+  int Get() const { return fd_; }
+
+private:
+  const int fd_;
+};
+
+static std::shared_ptr<const FileDescriptor> OpenProcFile(int pid, const char *name, int flags) {
+  char path[100];
+  snprintf(path, 99, "/proc/%d/%s", pid, name);
+  int fd = open(path, flags | O_CLOEXEC);
+  if (fd < 0) {
+    Utility::PrintErrnoString("Can't open %s", path);
+    return nullptr;
+  }
+  return std::make_shared<const FileDescriptor>(fd);
+}
+
 // 全スレッドをATTACHしてからwaitする
 // 使い方が合っているかどうかは不明
 bool Memory::Attach() {
   assert(pid_ >= 0);
   ClearCache();
   if (without_ptrace_ || attached_) {
+    OpenFileDescriptors();
     attached_ = true;
     return true;
   }
@@ -56,12 +91,14 @@ bool Memory::Attach() {
     Utility::PrintErrnoString("Fail wait pid=%d", pid_);
     return false;
   }
+  OpenFileDescriptors();
   attached_ = true;
   Utility::DebugLog("Attach  %d", pid_);
   return true;
 }
 
 bool Memory::Detach() {
+  CloseFileDescriptors();
   if (without_ptrace_ || !attached_) {
     attached_ = false;
     return true;
@@ -76,27 +113,87 @@ bool Memory::Detach() {
   return true;
 }
 
-size_t Memory::Read(uint8_t *dest, const Range &src) const {
+size_t Memory::Read(uint8_t *dest, const Range &src, std::vector<Range> *unreadable) const {
   assert(pid_ >= 0);
   assert(attached_);
-  size_t n = src.Size();
-  char path[100];
-  snprintf(path, 99, "/proc/%d/mem", pid_);
+  const size_t start = src.GetStart().to_i();
+  const size_t end = src.GetEnd().to_i();
+  std::vector<Range> holes;
+  size_t ret = 0;
 
-  int fd = open(path, O_RDONLY);
-  lseek64(fd, (unsigned long)src.GetStart().to_i(), SEEK_SET);
-  size_t ret = read(fd, dest, n);
-  close(fd);
-  if (ret == -1) {
-    Utility::DebugLog("*** Error : Memory Read is failed ***\nAddress: %zx\n%s (errno=%d)\n", src.GetStart().to_i(),
-                      strerror(errno), errno);
-    return 0;
-  } else if (ret != n) {
+  const std::shared_ptr<const FileDescriptor> fd = std::atomic_load(&read_fd_);
+  if (!fd) {
+    holes.emplace_back(start, end, src.GetComment());
+  } else {
+    // 既に読めないと分かっているページはsyscallせずに読み飛ばす
+    size_t p = start;
+    std::vector<Range> known = GetUnreadablePages(start, end);
+    known.emplace_back(end, end, "");
+    for (auto it = known.begin(); it != known.end(); it++) {
+      size_t q = it->GetStart().to_i();
+      if (p < q) {
+        std::vector<Range> found;
+        ret += ReadSpan(fd->Get(), dest + (p - start), p, q, found);
+        // 新しく見つかった読めない範囲は連続している部分をまとめて表示する
+        for (size_t i = 0, j = 0; i < found.size(); i = j) {
+          for (j = i + 1; j < found.size() && found[j - 1].GetEnd() == found[j].GetStart(); j++) {
+          }
+          Utility::DebugLog("Skip unreadable memory: %zx-%zx (%s)", found[i].GetStart().to_i(),
+                            found[j - 1].GetEnd().to_i(), src.GetComment().c_str());
+        }
+        holes.insert(holes.end(), found.begin(), found.end());
+      }
+      if (it->Size() > 0) {
+        memset(dest + (q - start), 0, it->Size());
+        holes.emplace_back(*it);
+      }
+      p = it->GetEnd().to_i();
+    }
+  }
+
+  if (ret != src.Size() && unreadable == nullptr) {
     Utility::DebugLog("*** Error : Memory Read is failed ***\nExpected length: "
                       "%zu\nRead length: %zu\nAddress: %zx\n",
-                      n, ret, src.GetStart().to_i());
+                      src.Size(), ret, start);
+  }
+  if (unreadable != nullptr) {
+    std::sort(holes.begin(), holes.end());
+    unreadable->insert(unreadable->end(), holes.begin(), holes.end());
   }
+  return ret;
+}
 
+/**
+ * [start, end)をpreadで読み込む
+ * 途中で読めなくなった場合は残りを二分して読み直し、読めるページは全て読み込む
+ */
+size_t Memory::ReadSpan(int fd, uint8_t *dest, size_t start, size_t end, std::vector<Range> &unreadable) const {
+  static const size_t page_size = getpagesize();
+  size_t ret = 0;
+  while (start < end) {
+    ssize_t s = pread64(fd, dest, end - start, (off64_t)start);
+    if (s > 0) {
+      ret += s;
+      start += s;
+      dest += s;
+      continue;
+    }
+    const size_t page = start & ~(page_size - 1);
+    if (end <= page + page_size) {
+      // 1ページ以内まで絞り込めたのでこのページは読めない
+      memset(dest, 0, end - start);
+      unreadable.emplace_back(start, end, "");
+      AddUnreadablePage(page, page + page_size);
+      break;
+    }
+    size_t mid = (start + (end - start) / 2) & ~(page_size - 1);
+    if (mid <= start) {
+      mid = page + page_size;
+    }
+    ret += ReadSpan(fd, dest, start, mid, unreadable);
+    ret += ReadSpan(fd, dest + (mid - start), mid, end, unreadable);
+    break;
+  }
   return ret;
 }
 
@@ -104,17 +201,69 @@ size_t Memory::ReadWithCache(uint8_t *dest, const Range &src, const Range &paren
   assert(pid_ >= 0);
   assert(attached_);
   assert(parent_range.IsSuperset(src));
-  if (parent_range.GetStart().to_i() != cache_range_.GetStart().to_i() ||
-      parent_range.GetEnd().to_i() != cache_range_.GetEnd().to_i()) {
-    cache_range_ = parent_range;
-    cache_ = std::make_unique<uint8_t[]>(cache_range_.Size());
-    Read(cache_.get(), parent_range);
+  // キャッシュには先頭から連続して読めた部分だけを入れる
+  size_t ret = cache_.Read(dest, src, parent_range, [this](uint8_t *d, const Range &r) {
+    std::vector<Range> unreadable;
+    size_t s = Read(d, r, &unreadable);
+    return unreadable.empty() ? s : unreadable.front().GetStart().to_i() - r.GetStart().to_i();
+  });
+  // ブロックの途中に読めない部分があった場合は直接読み込む
+  if (ret != src.Size()) {
+    ret = Read(dest, src);
   }
+  return ret;
+}
 
-  size_t offset = src.GetStart().to_i() - cache_range_.GetStart().to_i();
-  memcpy(dest, cache_.get() + offset, src.Size());
-
-  return src.Size();
+/**
+ * process_vm_readvで最大IOV_MAX個のアドレスを1回のsyscallで読み込む
+ * カーネルに拒否された場合(ENOSYS, EPERMなど)は/proc/[pid]/memのpreadで1つずつ読み込む
+ */
+size_t Memory::ReadVector(std::vector<IoRequest> &requests) const {
+  assert(pid_ >= 0);
+  assert(attached_);
+  const size_t BATCH = IOV_MAX;
+  struct iovec local[BATCH];
+  struct iovec remote[BATCH];
+  size_t cnt = 0;
+  size_t i = 0;
+  while (i < requests.size()) {
+    size_t batch = std::min(BATCH, requests.size() - i);
+    ssize_t ret = -1;
+    if (use_process_vm_.load()) {
+      for (size_t j = 0; j < batch; j++) {
+        local[j].iov_base = requests[i + j].data;
+        local[j].iov_len = requests[i + j].size;
+        remote[j].iov_base = (void *)requests[i + j].address;
+        remote[j].iov_len = requests[i + j].size;
+      }
+      ret = process_vm_readv(pid_, local, batch, remote, batch, 0);
+      if (ret == -1 && errno != EFAULT) {
+        Utility::PrintErrnoString("process_vm_readv is not available, fall back to pread");
+        use_process_vm_.store(false);
+        continue;
+      }
+    }
+    if (ret == -1) {
+      ret = 0;
+    }
+    // process_vm_readvはiovecの要素単位でしか途中終了しない
+    size_t j = i;
+    for (size_t done = ret; j < i + batch && requests[j].size <= done; j++) {
+      done -= requests[j].size;
+      requests[j].done = true;
+      cnt++;
+    }
+    // 読み込めなかった最初の要素は/proc/[pid]/memから読み込んでから次に進む
+    // 点で読むのはReadPlannerがブロック単位の読み込みより安いと判断した場合なので、キャッシュは通さない
+    if (j < i + batch) {
+      IoRequest &request = requests[j];
+      request.done = Read(request.data, Range(request.address, request.address + request.size, "")) == request.size;
+      cnt += request.done;
+      j++;
+    }
+    i = j;
+  }
+  return cnt;
 }
 
 // size_t Ptrace::ReadByPeekData(uint8_t *dest, const Address &src) const {
@@ -169,7 +318,6 @@ size_t Memory::WriteByPokeData(const Address &dest, long value) const {
 }
 
 size_t Memory::WriteByPokeData(const Range &dest, const uint8_t *src, bool freeze_request) const {
-  Utility::DebugLog("Using Poke");
   assert(pid_ >= 0);
   assert(attached_);
   assert(!without_ptrace_);
@@ -204,28 +352,32 @@ size_t Memory::WriteByPokeData(const Range &dest, const uint8_t *src, bool freez
 }
 
 size_t Memory::Write(const Range &dest, const uint8_t *src, bool freeze_request) const {
+  cache_.Invalidate(dest);
   if (!without_ptrace_) {
+    Utility::DebugLog("Using Poke");
     return WriteByPokeData(dest, src, freeze_request);
   }
   assert(pid_ >= 0);
   assert(attached_ || freeze_request);
   size_t n = dest.GetEnd().to_i() - dest.GetStart().to_i();
 
-  char path[100];
-  snprintf(path, 99, "/proc/%d/mem", pid_);
-
-  int fd = open(path, O_WRONLY);
-  lseek64(fd, (unsigned long)dest.GetStart().to_i(), SEEK_SET);
-  size_t ret = write(fd, src, n);
-  close(fd);
+  // Detach後もFreezeThreadからは書き込まれるので、その場合はその都度開く
+  std::shared_ptr<const FileDescriptor> fd = std::atomic_load(&write_fd_);
+  if (!fd) {
+    fd = OpenProcFile(pid_, "mem", O_WRONLY);
+    if (!fd) {
+      return 0;
+    }
+  }
+  ssize_t ret = pwrite64(fd->Get(), src, n, (off64_t)dest.GetStart().to_i());
   if (ret == -1) {
     Utility::DebugLog("*** Error : Memory Write is failed ***\nAddress: %zx\n%s (errno=%d)\n", dest.GetStart().to_i(),
                       strerror(errno), errno);
     return 0;
-  } else if (ret != n) {
+  } else if ((size_t)ret != n) {
     Utility::DebugLog("*** Error : Memory Write is failed ***\nExpected "
                       "length: %zu\nWrite length: %zu\nAddress: %zx\n",
-                      n, ret, dest.GetStart().to_i());
+                      n, (size_t)ret, dest.GetStart().to_i());
   }
 
   return ret;
@@ -247,6 +399,80 @@ size_t Memory::Write(const Range &dest, const uint8_t *src, bool freeze_request)
   // return n;
 }
 
+/**
+ * ptraceを使わない場合はprocess_vm_writevで最大IOV_MAX個のアドレスを1回のsyscallで書き込む
+ * 使えない場合は、アドレスもデータも連続しているリクエストをまとめてpwriteする
+ */
+size_t Memory::WriteVector(std::vector<IoRequest> &requests) const {
+  assert(pid_ >= 0);
+  assert(attached_);
+  size_t cnt = 0;
+  if (!without_ptrace_) {
+    // アドレス毎には表示せず、まとめて書き込む時に一度だけ表示する
+    Utility::DebugLog("Using Poke");
+    for (auto it = requests.begin(); it != requests.end(); it++) {
+      Range dest(it->address, it->address + it->size, "");
+      cache_.Invalidate(dest);
+      it->done = WriteByPokeData(dest, it->data, false) == it->size;
+      cnt += it->done;
+    }
+    return cnt;
+  }
+
+  const size_t BATCH = IOV_MAX;
+  struct iovec local[BATCH];
+  struct iovec remote[BATCH];
+  size_t i = 0;
+  while (i < requests.size()) {
+    size_t batch = std::min(BATCH, requests.size() - i);
+    ssize_t ret = -1;
+    if (use_process_vm_.load()) {
+      for (size_t j = 0; j < batch; j++) {
+        local[j].iov_base = requests[i + j].data;
+        local[j].iov_len = requests[i + j].size;
+        remote[j].iov_base = (void *)requests[i + j].address;
+        remote[j].iov_len = requests[i + j].size;
+      }
+      ret = process_vm_writev(pid_, local, batch, remote, batch, 0);
+      if (ret == -1 && errno != EFAULT) {
+        Utility::PrintErrnoString("process_vm_writev is not available, fall back to pwrite");
+        use_process_vm_.store(false);
+        continue;
+      }
+    }
+    if (ret == -1) {
+      ret = 0;
+    }
+    size_t j = i;
+    for (size_t done = ret; j < i + batch && requests[j].size <= done; j++) {
+      done -= requests[j].size;
+      requests[j].done = true;
+      cache_.Invalidate(Range(requests[j].address, requests[j].address + requests[j].size, ""));
+      cnt++;
+    }
+    if (j == i + batch) {
+      i = j;
+      continue;
+    }
+    // 書き込めなかった要素から、連続しているリクエストをまとめてpwriteする
+    size_t k = j + 1;
+    size_t n = requests[j].size;
+    while (k < requests.size() && requests[k - 1].address + requests[k - 1].size == requests[k].address &&
+           requests[k - 1].data + requests[k - 1].size == requests[k].data) {
+      n += requests[k].size;
+      k++;
+    }
+    size_t written = Write(Range(requests[j].address, requests[j].address + n, ""), requests[j].data, false);
+    for (; j < k; j++) {
+      requests[j].done = written >= requests[j].size;
+      written -= std::min(written, requests[j].size);
+      cnt += requests[j].done;
+    }
+    i = k;
+  }
+  return cnt;
+}
+
 void Memory::Dump(const Range &src) const {
   assert(pid_ >= 0);
   assert(attached_);
@@ -256,7 +482,8 @@ void Memory::Dump(const Range &src) const {
     return;
   }
   const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
-  size_t l = Read(temp_p.get(), src);
+  // 近くのアドレスを続けてダンプすることが多いのでキャッシュ付きで読む
+  size_t l = ReadWithCache(temp_p.get(), src, Range(0, SIZE_MAX, ""));
   Utility::DebugLog("%s",
                     Utility::HexDump(src.GetStart().to_i(), src.GetComment().c_str(), temp_p.get(), l, 2).c_str());
 }
@@ -283,9 +510,257 @@ void Memory::LoadThreadIDs() {
   closedir(dp);
 }
 
-void Memory::ClearCache() {
-  cache_range_ = Range();
-  cache_.reset();
+void Memory::ClearCache() { cache_.Clear(); }
+
+void Memory::AddUnreadablePage(size_t start, size_t end) const {
+  std::lock_guard<std::mutex> lock(unreadable_mutex_);
+  // 隣接する範囲とはまとめて持つ
+  auto it = unreadable_pages_.upper_bound(start);
+  if (it != unreadable_pages_.begin() && std::prev(it)->second >= start) {
+    --it;
+    start = it->first;
+    end = std::max(end, it->second);
+    it = unreadable_pages_.erase(it);
+  }
+  while (it != unreadable_pages_.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    it = unreadable_pages_.erase(it);
+  }
+  unreadable_pages_[start] = end;
+}
+
+std::vector<Range> Memory::GetUnreadablePages(size_t start, size_t end) const {
+  std::lock_guard<std::mutex> lock(unreadable_mutex_);
+  std::vector<Range> ret;
+  auto it = unreadable_pages_.upper_bound(start);
+  if (it != unreadable_pages_.begin()) {
+    --it;
+  }
+  for (; it != unreadable_pages_.end() && it->first < end; it++) {
+    if (it->second > start) {
+      ret.emplace_back(std::max(start, it->first), std::min(end, it->second), "");
+    }
+  }
+  return ret;
+}
+
+void Memory::ClearUnreadablePages() {
+  std::lock_guard<std::mutex> lock(unreadable_mutex_);
+  unreadable_pages_.clear();
+}
+
+void Memory::InvalidateMapping(const Range &range) {
+  cache_.Invalidate(range);
+  const size_t start = range.GetStart().to_i();
+  const size_t end = range.GetEnd().to_i();
+  std::lock_guard<std::mutex> lock(unreadable_mutex_);
+  auto it = unreadable_pages_.upper_bound(start);
+  if (it != unreadable_pages_.begin()) {
+    --it;
+  }
+  while (it != unreadable_pages_.end() && it->first < end) {
+    const size_t page_start = it->first;
+    const size_t page_end = it->second;
+    if (page_end <= start) {
+      ++it;
+      continue;
+    }
+    // rangeからはみ出している部分は残す
+    it = unreadable_pages_.erase(it);
+    if (page_start < start) {
+      unreadable_pages_[page_start] = start;
+    }
+    if (page_end > end) {
+      unreadable_pages_[end] = page_end;
+    }
+  }
+}
+
+void Memory::OpenFileDescriptors() {
+  if (!std::atomic_load(&read_fd_)) {
+    std::atomic_store(&read_fd_, OpenProcFile(pid_, "mem", O_RDONLY));
+  }
+  if (without_ptrace_ && !std::atomic_load(&write_fd_)) {
+    std::atomic_store(&write_fd_, OpenProcFile(pid_, "mem", O_WRONLY));
+  }
+  if (!std::atomic_load(&pagemap_fd_)) {
+    std::atomic_store(&pagemap_fd_, OpenProcFile(pid_, "pagemap", O_RDONLY));
+  }
+}
+
+// 使用中のスレッドがあっても、参照が外れた時点で閉じられる
+void Memory::CloseFileDescriptors() {
+  std::atomic_store(&read_fd_, std::shared_ptr<const FileDescriptor>());
+  std::atomic_store(&write_fd_, std::shared_ptr<const FileDescriptor>());
+  std::atomic_store(&pagemap_fd_, std::shared_ptr<const FileDescriptor>());
+  ClearUnreadablePages();
+}
+
+// /proc/[pid]/pagemapの1ページ分のエントリ
+static const uint64_t PAGEMAP_PRESENT = 1ULL << 63;
+static const uint64_t PAGEMAP_SWAPPED = 1ULL << 62;
+static const uint64_t PAGEMAP_SOFT_DIRTY = 1ULL << 55;
+static const uint64_t PAGEMAP_PFN_MASK = (1ULL << 55) - 1;
+
+/**
+ * 共有ゼロページの物理フレーム番号を求める
+ * 自プロセスで読み込みだけしたページは共有ゼロページに割り当てられることを利用する
+ * CAP_SYS_ADMINが無いとフレーム番号は0になるので、その場合は判定しない
+ */
+static uint64_t GetZeroPageFrame() {
+  const size_t page_size = getpagesize();
+  uint64_t ret = 0;
+  volatile uint8_t *p = (volatile uint8_t *)mmap(nullptr, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return 0;
+  }
+  (void)p[0];
+  int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  uint64_t entry = 0;
+  if (fd >= 0 && pread64(fd, &entry, sizeof(entry), (off64_t)((size_t)p / page_size * sizeof(entry))) ==
+                     sizeof(entry)) {
+    if (entry & PAGEMAP_PRESENT) {
+      ret = entry & PAGEMAP_PFN_MASK;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  munmap((void *)p, page_size);
+  return ret;
+}
+
+/**
+ * /proc/[pid]/pagemapを読んで、エントリがpredicateを満たすページの範囲をrangesに追加する
+ * pagemapが読めなかった部分はpredicateを満たすものとして扱い、falseを返す
+ */
+static bool CollectPages(int fd, const Range &range, const std::function<bool(uint64_t entry)> &predicate,
+                         std::vector<Range> &ranges) {
+  static const size_t page_size = getpagesize();
+  const size_t BATCH = 8192;
+  uint64_t entries[BATCH];
+
+  const size_t first = range.GetStart().to_i() / page_size;
+  const size_t last = (range.GetEnd().to_i() + page_size - 1) / page_size;
+  size_t run_start = 0;
+  bool in_run = false;
+  for (size_t page = first; page < last; page += BATCH) {
+    size_t n = std::min(BATCH, last - page);
+    ssize_t s = pread64(fd, entries, n * sizeof(uint64_t), (off64_t)(page * sizeof(uint64_t)));
+    if (s != (ssize_t)(n * sizeof(uint64_t))) {
+      if (!in_run) {
+        run_start = std::max(page * page_size, range.GetStart().to_i());
+      }
+      ranges.emplace_back(run_start, range.GetEnd().to_i(), range.GetComment());
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      bool match = predicate(entries[i]);
+      size_t address = std::max((page + i) * page_size, range.GetStart().to_i());
+      if (match && !in_run) {
+        run_start = address;
+        in_run = true;
+      } else if (!match && in_run) {
+        ranges.emplace_back(run_start, address, range.GetComment());
+        in_run = false;
+      }
+    }
+  }
+  if (in_run) {
+    ranges.emplace_back(run_start, range.GetEnd().to_i(), range.GetComment());
+  }
+  return true;
+}
+
+/**
+ * 実際にデータを持っているページの範囲を求める
+ * ファイルをマップした領域は、触られていなくても読めばファイルの内容が入っているので全て対象にする
+ */
+bool Memory::GetResidentRanges(const Range &range, std::vector<Range> &resident) const {
+  assert(pid_ >= 0);
+  const std::string &comment = range.GetComment();
+  const bool anonymous = comment.empty() || comment[0] == '[';
+  const std::shared_ptr<const FileDescriptor> fd = std::atomic_load(&pagemap_fd_);
+  if (!anonymous || !fd) {
+    resident.push_back(range);
+    return false;
+  }
+  static const uint64_t zero_page_frame = GetZeroPageFrame();
+  return CollectPages(fd->Get(), range,
+                      [](uint64_t entry) {
+                        return (entry & PAGEMAP_SWAPPED) ||
+                               ((entry & PAGEMAP_PRESENT) &&
+                                (zero_page_frame == 0 || (entry & PAGEMAP_PFN_MASK) != zero_page_frame));
+                      },
+                      resident);
+}
+
+/**
+ * soft-dirtyビットが使えるかを自プロセスで確認する
+ * CONFIG_MEM_SOFT_DIRTYが無いカーネルではclear_refsへの書き込みは成功するがビットは常に0になる
+ */
+static bool IsSoftDirtySupported() {
+  const size_t page_size = getpagesize();
+  volatile uint8_t *p =
+      (volatile uint8_t *)mmap(nullptr, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  int clear_refs = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  auto is_dirty = [&]() {
+    uint64_t entry = 0;
+    pread64(pagemap, &entry, sizeof(entry), (off64_t)((size_t)p / page_size * sizeof(entry)));
+    return (entry & PAGEMAP_SOFT_DIRTY) != 0;
+  };
+  bool ret = false;
+  if (pagemap >= 0 && clear_refs >= 0) {
+    p[0] = 1;
+    if (write(clear_refs, "4", 1) == 1 && !is_dirty()) {
+      p[0] = 2;
+      ret = is_dirty();
+    }
+  }
+  if (pagemap >= 0) {
+    close(pagemap);
+  }
+  if (clear_refs >= 0) {
+    close(clear_refs);
+  }
+  munmap((void *)p, page_size);
+  return ret;
+}
+
+bool Memory::ClearSoftDirty() const {
+  assert(pid_ >= 0);
+  static const bool supported = IsSoftDirtySupported();
+  if (!supported) {
+    return false;
+  }
+  char path[100];
+  snprintf(path, 99, "/proc/%d/clear_refs", pid_);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Utility::PrintErrnoString("Can't open %s", path);
+    return false;
+  }
+  bool ret = write(fd, "4", 1) == 1;
+  if (!ret) {
+    Utility::PrintErrnoString("Can't write %s", path);
+  }
+  close(fd);
+  return ret;
+}
+
+bool Memory::GetDirtyRanges(const Range &range, std::vector<Range> &dirty) const {
+  assert(pid_ >= 0);
+  const std::shared_ptr<const FileDescriptor> fd = std::atomic_load(&pagemap_fd_);
+  if (!fd) {
+    dirty.push_back(range);
+    return false;
+  }
+  return CollectPages(
+      fd->Get(), range, [](uint64_t entry) { return (entry & PAGEMAP_SOFT_DIRTY) != 0; }, dirty);
 }
 
 /**
@@ -312,4 +787,39 @@ bool Memory::GenerateMaps(std::stringstream &ss) {
   }
   fclose(fp);
   return true;
+}
+
+bool Memory::ReadMaps(std::string &maps) {
+  assert(pid_ >= 0);
+  char mmap_path[64];
+  sprintf(mmap_path, "/proc/%d/maps", GetPid());
+  int fd = open(mmap_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Utility::DebugLog("process maps file '%s' can't be opend", mmap_path);
+    return false;
+  }
+  // 行毎に読まずに大きく読み込む、前回の領域が足りていれば確保し直さない
+  const size_t READ_SIZE = 64 * 1024;
+  size_t size = 0;
+  while (true) {
+    if (maps.size() < size + READ_SIZE) {
+      maps.resize(size + READ_SIZE);
+    }
+    ssize_t n = read(fd, &maps[size], READ_SIZE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      Utility::DebugLog("process maps file '%s' can't be read: %s", mmap_path, strerror(errno));
+      close(fd);
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    size += n;
+  }
+  close(fd);
+  maps.resize(size);
+  return true;
 }
\ No newline at end of file
@@ -42,32 +42,38 @@ bool Memory::Detach() {
   return true;
 }
 
-size_t Memory::Read(uint8_t *dest, const Range &src) const {
+size_t Memory::Read(uint8_t *dest, const Range &src, std::vector<Range> *unreadable) const {
   assert(pid_ >= 0);
   assert(attached_);
 
   size_t n = src.Size();
 
+  SIZE_T bytesRead = 0;
   HANDLE hProcess = OpenProcess(PROCESS_VM_READ, false, pid_);
   if (hProcess == NULL) {
     Utility::DebugLog("*** Error : OpenProcess failed ***\nPID: %d\n%s (errno=%d)\n", pid_, strerror(errno), errno);
-    return 0;
+  } else {
+    BOOL result = ReadProcessMemory(hProcess, (LPCVOID)src.GetStart().to_i(), dest, n, &bytesRead);
+    CloseHandle(hProcess);
+
+    if (!result) {
+      Utility::DebugLog("*** Error : Memory Read failed ***\nAddress: %zx\n%s (errno=%d)\n", src.GetStart().to_i(),
+                        strerror(errno), errno);
+      bytesRead = 0;
+    } else if (bytesRead != n) {
+      Utility::DebugLog("*** Error : Memory Read failed ***\nExpected length: "
+                        "%zu\nRead length: %zu\nAddress: %zx\n",
+                        n, bytesRead, src.GetStart().to_i());
+    }
   }
 
-  SIZE_T bytesRead;
-  BOOL result = ReadProcessMemory(hProcess, (LPCVOID)src.GetStart().to_i(), dest, n, &bytesRead);
-  CloseHandle(hProcess);
-
-  if (!result) {
-    Utility::DebugLog("*** Error : Memory Read failed ***\nAddress: %zx\n%s (errno=%d)\n", src.GetStart().to_i(),
-                      strerror(errno), errno);
-    return 0;
-  } else if (bytesRead != n) {
-    Utility::DebugLog("*** Error : Memory Read failed ***\nExpected length: "
-                      "%zu\nRead length: %zu\nAddress: %zx\n",
-                      n, bytesRead, src.GetStart().to_i());
+  // 読めなかった部分は0で埋める
+  if (bytesRead < n) {
+    memset(dest + bytesRead, 0, n - bytesRead);
+    if (unreadable != nullptr) {
+      unreadable->emplace_back(src.GetStart().to_i() + bytesRead, src.GetEnd().to_i(), src.GetComment());
+    }
   }
-
   return bytesRead;
 }
 
@@ -75,17 +81,21 @@ size_t Memory::ReadWithCache(uint8_t *dest, const Range &src, const Range &paren
   assert(pid_ >= 0);
   assert(attached_);
   assert(parent_range.IsSuperset(src));
-  if (parent_range.GetStart().to_i() != cache_range_.GetStart().to_i() ||
-      parent_range.GetEnd().to_i() != cache_range_.GetEnd().to_i()) {
-    cache_range_ = parent_range;
-    cache_ = std::make_unique<uint8_t[]>(cache_range_.Size());
-    Read(cache_.get(), parent_range);
+  size_t ret = cache_.Read(dest, src, parent_range, [this](uint8_t *d, const Range &r) { return Read(d, r); });
+  // ブロックの途中に読めない部分があった場合は直接読み込む
+  if (ret != src.Size()) {
+    ret = Read(dest, src);
   }
+  return ret;
+}
 
-  size_t offset = src.GetStart().to_i() - cache_range_.GetStart().to_i();
-  memcpy(dest, cache_.get() + offset, src.Size());
-
-  return src.Size();
+size_t Memory::ReadVector(std::vector<IoRequest> &requests) const {
+  size_t cnt = 0;
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    it->done = Read(it->data, Range(it->address, it->address + it->size, "")) == it->size;
+    cnt += it->done;
+  }
+  return cnt;
 }
 
 size_t Memory::WriteByPokeData(const Address &dest, long value) const { return 0; }
@@ -93,6 +103,7 @@ size_t Memory::WriteByPokeData(const Address &dest, long value) const { return 0
 size_t Memory::WriteByPokeData(const Range &dest, const uint8_t *src, bool freeze_request) const { return 0; }
 
 size_t Memory::Write(const Range &dest, const uint8_t *src, bool freeze_request) const {
+  cache_.Invalidate(dest);
   assert(pid_ >= 0);
   assert(attached_ || freeze_request);
 
@@ -121,6 +132,15 @@ size_t Memory::Write(const Range &dest, const uint8_t *src, bool freeze_request)
   return bytesWritten;
 }
 
+size_t Memory::WriteVector(std::vector<IoRequest> &requests) const {
+  size_t cnt = 0;
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    it->done = Write(Range(it->address, it->address + it->size, ""), it->data, false) == it->size;
+    cnt += it->done;
+  }
+  return cnt;
+}
+
 void Memory::Dump(const Range &src) const {
   assert(pid_ >= 0);
   assert(attached_);
@@ -130,18 +150,39 @@ void Memory::Dump(const Range &src) const {
     return;
   }
   const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
-  size_t l = Read(temp_p.get(), src);
+  // 近くのアドレスを続けてダンプすることが多いのでキャッシュ付きで読む
+  size_t l = ReadWithCache(temp_p.get(), src, Range(0, SIZE_MAX, ""));
   Utility::DebugLog("%s",
                     Utility::HexDump(src.GetStart().to_i(), src.GetComment().c_str(), temp_p.get(), l, 2).c_str());
 }
 
+bool Memory::GetResidentRanges(const Range &range, std::vector<Range> &resident) const {
+  resident.push_back(range);
+  return false;
+}
+
+bool Memory::ClearSoftDirty() const { return false; }
+
+bool Memory::GetDirtyRanges(const Range &range, std::vector<Range> &dirty) const {
+  dirty.push_back(range);
+  return false;
+}
+
 void Memory::LoadThreadIDs() {}
 
-void Memory::ClearCache() {
-  cache_range_ = Range();
-  cache_.reset();
+void Memory::ClearCache() { cache_.Clear(); }
+
+bool Memory::ReadMaps(std::string &maps) {
+  std::stringstream ss;
+  if (!GenerateMaps(ss)) {
+    return false;
+  }
+  maps = ss.str();
+  return true;
 }
 
+void Memory::InvalidateMapping(const Range &range) { cache_.Invalidate(range); }
+
 bool Memory::GenerateMaps(std::stringstream &ss) {
   assert(pid_ >= 0);
 
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cmath>
+#include <errno.h>
+#include <limits>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+#include "NumericPredicate.h"
+
+namespace {
+// 一度に比較するバイト数、SSE2やNEONのレジスタ1つ分
+const size_t VECTOR_SIZE = 16;
+
+// 型とバイトオーダーの組
+template <class T, bool Swap> struct TypeTag {
+  typedef T type;
+  static const bool swap = Swap;
+};
+
+/**
+ * typeに対応するTypeTagでfを呼ぶ、数値型でなければfalseを返す
+ */
+template <class F> bool Visit(const Converter::Type &type, F &&f) {
+  switch (type) {
+  case Converter::Type::INT8:
+    f(TypeTag<int8_t, false>());
+    return true;
+  case Converter::Type::INT16_LITTLE_ENDIAN:
+    f(TypeTag<int16_t, false>());
+    return true;
+  case Converter::Type::INT_LITTLE_ENDIAN:
+    f(TypeTag<int32_t, false>());
+    return true;
+  case Converter::Type::INT_BIG_ENDIAN:
+    f(TypeTag<int32_t, true>());
+    return true;
+  case Converter::Type::LONG_LITTLE_ENDIAN:
+    f(TypeTag<long, false>());
+    return true;
+  case Converter::Type::LONG_BIG_ENDIAN:
+    f(TypeTag<long, true>());
+    return true;
+  case Converter::Type::UINT8:
+    f(TypeTag<uint8_t, false>());
+    return true;
+  case Converter::Type::UINT16_LITTLE_ENDIAN:
+    f(TypeTag<uint16_t, false>());
+    return true;
+  case Converter::Type::UINT_LITTLE_ENDIAN:
+    f(TypeTag<uint32_t, false>());
+    return true;
+  case Converter::Type::ULONG_LITTLE_ENDIAN:
+    f(TypeTag<unsigned long, false>());
+    return true;
+  case Converter::Type::FLOAT_LITTLE_ENDIAN:
+  case Converter::Type::FLOAT_FUZZY_LITTLE_ENDIAN:
+    f(TypeTag<float, false>());
+    return true;
+  case Converter::Type::FLOAT_BIG_ENDIAN:
+    f(TypeTag<float, true>());
+    return true;
+  case Converter::Type::DOUBLE_LITTLE_ENDIAN:
+  case Converter::Type::DOUBLE_FUZZY_LITTLE_ENDIAN:
+    f(TypeTag<double, false>());
+    return true;
+  case Converter::Type::DOUBLE_BIG_ENDIAN:
+    f(TypeTag<double, true>());
+    return true;
+  default:
+    return false;
+  }
+}
+
+template <class T, bool Swap> inline T Load(const uint8_t *p) {
+  uint8_t bytes[sizeof(T)];
+  if (Swap) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+      bytes[i] = p[sizeof(T) - 1 - i];
+    }
+  } else {
+    memcpy(bytes, p, sizeof(T));
+  }
+  T value;
+  memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+template <class T> bool ParseValue(const std::string &str, T &value) {
+  if (str.empty()) {
+    return false;
+  }
+  char *end = nullptr;
+  errno = 0;
+  if (std::is_floating_point<T>::value) {
+    value = (T)strtod(str.c_str(), &end);
+  } else if (std::is_signed<T>::value) {
+    long long v = strtoll(str.c_str(), &end, 10);
+    if (v < (long long)std::numeric_limits<T>::min() || v > (long long)std::numeric_limits<T>::max()) {
+      return false;
+    }
+    value = (T)v;
+  } else {
+    if (str[0] == '-') {
+      return false;
+    }
+    unsigned long long v = strtoull(str.c_str(), &end, 10);
+    if (v > (unsigned long long)std::numeric_limits<T>::max()) {
+      return false;
+    }
+    value = (T)v;
+  }
+  return errno == 0 && *end == '\0';
+}
+
+/**
+ * alignの倍数の位置にある値をpredで調べる
+ * alignが型の大きさと同じ場合は、VECTOR_SIZEバイトずつベクトル演算で比較する
+ */
+template <class T, bool Swap, class Pred>
+void FindTyped(const uint8_t *src, size_t n, size_t first, size_t align, T lo, T hi, const Pred &pred,
+               std::vector<size_t> &found) {
+  size_t i = first;
+#if defined(__GNUC__)
+  if (!Swap && align == sizeof(T)) {
+    typedef T Vector __attribute__((vector_size(VECTOR_SIZE)));
+    const size_t lanes = VECTOR_SIZE / sizeof(T);
+    Vector lo_vector, hi_vector;
+    for (size_t k = 0; k < lanes; k++) {
+      lo_vector[k] = lo;
+      hi_vector[k] = hi;
+    }
+    for (; i + VECTOR_SIZE <= n; i += VECTOR_SIZE) {
+      Vector v;
+      memcpy(&v, src + i, VECTOR_SIZE);
+      const auto mask = pred(v, lo_vector, hi_vector);
+      // ほとんどのブロックには何も無いので、まとめて判定してから1つずつ調べる
+      uint64_t bits[VECTOR_SIZE / 8];
+      memcpy(bits, &mask, VECTOR_SIZE);
+      uint64_t any = 0;
+      for (size_t k = 0; k < VECTOR_SIZE / 8; k++) {
+        any |= bits[k];
+      }
+      if (any == 0) {
+        continue;
+      }
+      for (size_t k = 0; k < lanes; k++) {
+        if (mask[k]) {
+          found.push_back(i + k * sizeof(T));
+        }
+      }
+    }
+  }
+#endif
+  for (; i + sizeof(T) <= n; i += align) {
+    if (pred(Load<T, Swap>(src + i), lo, hi)) {
+      found.push_back(i);
+    }
+  }
+}
+
+// スカラーとベクトルの両方で使えるように、&&ではなく&で繋ぐ
+template <class T, bool Swap>
+void FindByOp(NumericPredicate::Op op, const uint8_t *src, size_t n, size_t first, size_t align, T lo, T hi,
+              std::vector<size_t> &found) {
+  switch (op) {
+  case NumericPredicate::Op::EQ:
+    FindTyped<T, Swap>(src, n, first, align, lo, hi, [](auto v, auto a, auto) { return v == a; }, found);
+    break;
+  case NumericPredicate::Op::NE:
+    FindTyped<T, Swap>(src, n, first, align, lo, hi, [](auto v, auto a, auto) { return v != a; }, found);
+    break;
+  case NumericPredicate::Op::LT:
+    FindTyped<T, Swap>(src, n, first, align, lo, hi, [](auto v, auto a, auto) { return v < a; }, found);
+    break;
+  case NumericPredicate::Op::GT:
+    FindTyped<T, Swap>(src, n, first, align, lo, hi, [](auto v, auto a, auto) { return v > a; }, found);
+    break;
+  case NumericPredicate::Op::BETWEEN:
+    FindTyped<T, Swap>(src, n, first, align, lo, hi, [](auto v, auto a, auto b) { return (a <= v) & (v <= b); },
+                       found);
+    break;
+  }
+}
+} // namespace
+
+bool NumericPredicate::Init(const std::string &type, const std::string &op, const std::vector<std::string> &args) {
+  std::map<std::string, Op> ops = {
+      {"eq", Op::EQ}, {"ne", Op::NE}, {"lt", Op::LT}, {"gt", Op::GT}, {"between", Op::BETWEEN}, {"tol", Op::BETWEEN},
+  };
+  type_ = Converter::GetType(type);
+  if (!IsNumeric(type_) || !ops.count(op)) {
+    type_ = Converter::Type::INVALID;
+    return false;
+  }
+  op_ = ops[op];
+  const size_t arity = op_ == Op::BETWEEN ? 2 : 1;
+  if (args.size() != arity) {
+    type_ = Converter::Type::INVALID;
+    return false;
+  }
+
+  bool ok = false;
+  Visit(type_, [&](auto tag) {
+    typedef typename decltype(tag)::type T;
+    T lo = 0, hi = 0;
+    if (!ParseValue(args[0], lo) || (arity == 2 && !ParseValue(args[1], hi))) {
+      return;
+    }
+    if (op == "tol") {
+      // 値±許容誤差の範囲に変換する、整数は型の範囲に収める
+      const T value = lo;
+      const T tolerance = hi;
+      if (tolerance < 0) {
+        return;
+      }
+      if (std::is_floating_point<T>::value) {
+        lo = value - tolerance;
+        hi = value + tolerance;
+      } else {
+        lo = value < std::numeric_limits<T>::lowest() + tolerance ? std::numeric_limits<T>::lowest()
+                                                                  : (T)(value - tolerance);
+        hi = value > std::numeric_limits<T>::max() - tolerance ? std::numeric_limits<T>::max() : (T)(value + tolerance);
+      }
+    }
+    memcpy(lo_, &lo, sizeof(T));
+    memcpy(hi_, &hi, sizeof(T));
+    ok = true;
+  });
+  if (!ok) {
+    type_ = Converter::Type::INVALID;
+    return false;
+  }
+  description_ = type + " " + op;
+  for (auto it = args.begin(); it != args.end(); it++) {
+    description_ += " " + *it;
+  }
+  return true;
+}
+
+/**
+ * fuzzyの範囲を作る
+ */
+template <class T>
+static std::string MakeFuzzyRange(const std::vector<uint8_t> &value, double below, double above, size_t ulp,
+                                  uint8_t *lo_bytes, uint8_t *hi_bytes) {
+  T v;
+  memcpy(&v, value.data(), sizeof(T));
+  T lo = v, hi = v;
+  if (ulp > 0) {
+    for (size_t i = 0; i < ulp; i++) {
+      lo = std::nextafter(lo, -std::numeric_limits<T>::infinity());
+      hi = std::nextafter(hi, std::numeric_limits<T>::infinity());
+    }
+  } else {
+    lo = (T)(v - below);
+    hi = (T)(v + above);
+  }
+  memcpy(lo_bytes, &lo, sizeof(T));
+  memcpy(hi_bytes, &hi, sizeof(T));
+  char str[100];
+  snprintf(str, 99, " between %.8g %.8g", (double)lo, (double)hi);
+  return str;
+}
+
+bool NumericPredicate::InitFuzzy(const Converter::Type &type, const std::vector<uint8_t> &value, double below,
+                                 double above, size_t ulp) {
+  op_ = Op::BETWEEN;
+  if (type == Converter::Type::FLOAT_FUZZY_LITTLE_ENDIAN && value.size() == sizeof(float)) {
+    type_ = type;
+    description_ = Converter::GetTypeString(type) + MakeFuzzyRange<float>(value, below, above, ulp, lo_, hi_);
+  } else if (type == Converter::Type::DOUBLE_FUZZY_LITTLE_ENDIAN && value.size() == sizeof(double)) {
+    type_ = type;
+    description_ = Converter::GetTypeString(type) + MakeFuzzyRange<double>(value, below, above, ulp, lo_, hi_);
+  } else {
+    type_ = Converter::Type::INVALID;
+    return false;
+  }
+  return true;
+}
+
+bool NumericPredicate::Test(const uint8_t *value) const {
+  std::vector<size_t> found;
+  Find(value, Size(), 0, Size(), found);
+  return !found.empty();
+}
+
+void NumericPredicate::Find(const uint8_t *src, size_t n, size_t address, size_t align,
+                            std::vector<size_t> &found) const {
+  Visit(type_, [&](auto tag) {
+    typedef typename decltype(tag)::type T;
+    const size_t step = align == 0 ? sizeof(T) : align;
+    // alignはチャンクの先頭ではなくアドレスに対して揃える
+    const size_t first = (step - address % step) % step;
+    T lo, hi;
+    memcpy(&lo, lo_, sizeof(T));
+    memcpy(&hi, hi_, sizeof(T));
+    FindByOp<T, decltype(tag)::swap>(op_, src, n, first, step, lo, hi, found);
+  });
+}
+
+size_t NumericPredicate::Size() const {
+  size_t size = 0;
+  Visit(type_, [&](auto tag) { size = sizeof(typename decltype(tag)::type); });
+  return size;
+}
+
+bool NumericPredicate::IsNumeric(const Converter::Type &type) {
+  return Visit(type, [](auto) {});
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Converter.h"
+
+/**
+ * 数値型の値に対する条件 (e.g. int between 90 110)
+ * Findはalignの倍数のアドレスにある値だけを型として解釈し、チャンク全体をベクトル演算でまとめて比較する
+ */
+class NumericPredicate {
+public:
+  enum class Op {
+    EQ,
+    NE,
+    LT,
+    GT,
+    BETWEEN, // tolもこれに変換する
+  };
+
+  NumericPredicate() : type_(Converter::Type::INVALID), op_(Op::EQ), lo_(), hi_() { ; }
+  // type, opと値を文字列から解釈する、解釈できなければfalseを返す
+  // eq, ne, lt, gtは値1つ、betweenは下限と上限、tolは値と許容誤差を取る
+  bool Init(const std::string &type, const std::string &op, const std::vector<std::string> &args);
+  // float_fuzzy, double_fuzzyの値valueから、value - below以上value + above以下の範囲を作る
+  // ulpが0でなければ、代わりに前後ulp個分の表現可能な値の範囲にする
+  bool InitFuzzy(const Converter::Type &type, const std::vector<uint8_t> &value, double below, double above,
+                 size_t ulp);
+
+  // value (Size()バイト) が条件を満たすか
+  bool Test(const uint8_t *value) const;
+  // addressから始まるsrcのnバイトの中で、条件を満たす値の位置を昇順にfoundに追加する
+  // alignが0の場合は型の大きさに揃える
+  void Find(const uint8_t *src, size_t n, size_t address, size_t align, std::vector<size_t> &found) const;
+
+  Converter::Type GetType() const { return type_; }
+  size_t Size() const;
+  const std::string &ToString() const { return description_; }
+
+  static bool IsNumeric(const Converter::Type &type);
+  static void PrintCommandUsage() {
+    fprintf(stderr, "Predicate (lookup_if, filter_if)\n");
+    fprintf(stderr, "  [type] eq [value]\n");
+    fprintf(stderr, "  [type] ne [value]\n");
+    fprintf(stderr, "  [type] lt [value]\n");
+    fprintf(stderr, "  [type] gt [value]\n");
+    fprintf(stderr, "  [type] between [min] [max]\n");
+    fprintf(stderr, "  [type] tol [value] [tolerance]\n");
+  }
+
+private:
+  Converter::Type type_;
+  Op op_;
+  // 比較に使う値、型に合わせてホストのバイトオーダーで入れておく
+  uint8_t lo_[8];
+  uint8_t hi_[8];
+  std::string description_; // ログ用
+};
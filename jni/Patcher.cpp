@@ -16,16 +16,21 @@
  */
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string.h>
+#include <thread>
 #include <time.h>
 #include <vector>
 
 #include "Config.h"
 #include "Converter.h"
+#include "NumericPredicate.h"
 #include "Patcher.h"
+#include "RangeScanner.h"
+#include "Search.h"
 #include "Snapshot.h"
 #include "Utility.h"
 
@@ -35,6 +40,7 @@ std::string Patcher::GetModeString(Mode mode) {
       {Mode::LOOKUP, "lookup"},
       {Mode::FILTER, "filter"},
       {Mode::CHANGE, "change"},
+      {Mode::COUNT, "count"},
   };
   assert(temp.count(mode));
   return temp[mode];
@@ -43,6 +49,8 @@ Patcher::Mode Patcher::GetMode(const std::string &str) {
   std::map<std::string, Mode> temp = {
       {"nop", Mode::NOP},  {"lookup", Mode::LOOKUP}, {"filter", Mode::FILTER}, {"change", Mode::CHANGE},
       {"l", Mode::LOOKUP}, {"f", Mode::FILTER},      {"c", Mode::CHANGE},
+      {"lookup_if", Mode::LOOKUP}, {"filter_if", Mode::FILTER},
+      {"count", Mode::COUNT},      {"count_if", Mode::COUNT},
   };
   assert(temp.count(str));
   return temp[str];
@@ -57,7 +65,7 @@ bool Patcher::Attach(const std::string &command, std::stringstream &sin) { retur
 bool Patcher::Detach(const std::string &command, std::stringstream &sin) { return memory_->Detach(); }
 
 bool Patcher::Clear(const std::string &command, std::stringstream &sin) {
-  addr_set_.clear();
+  addr_set_.Clear();
   return true;
 }
 
@@ -66,6 +74,16 @@ bool Patcher::Process(const std::string &command, std::stringstream &sin) {
   if (!(sin >> type >> str)) {
     return false;
   }
+  if (type == "any") {
+    return ProcessAny(GetMode(command), str);
+  }
+  if (type == "aob") {
+    // aobはバイト毎に空白で区切って書くので、区切りを残したまま行の残りを全て使う
+    std::string rest;
+    while (sin >> rest) {
+      str += " " + rest;
+    }
+  }
   ChangeString change_str;
   if (!change_str.Init(type, str)) {
     Utility::DebugLog("%s is wrong type", type.c_str());
@@ -78,6 +96,83 @@ bool Patcher::Process(const std::string &command, std::stringstream &sin) {
   return true;
 }
 
+bool Patcher::ProcessIf(const std::string &command, std::stringstream &sin) {
+  std::string type, op, arg;
+  if (!(sin >> type >> op)) {
+    return false;
+  }
+  std::vector<std::string> args;
+  while (sin >> arg) {
+    args.push_back(arg);
+  }
+  NumericPredicate predicate;
+  if (!predicate.Init(type, op, args)) {
+    Utility::DebugLog("'%s %s' is wrong predicate", type.c_str(), op.c_str());
+    return false;
+  }
+  if (!Process(GetMode(command), predicate)) {
+    return false;
+  }
+  Utility::DebugLog("Please Input Command");
+  return true;
+}
+
+/**
+ * 型の分からない数値を、考えられる全ての表現で探す
+ * filterでは、それぞれのアドレスを見つかった時の型の表現とだけ比べる
+ */
+bool Patcher::ProcessAny(const Mode mode, const std::string &str) {
+  const std::vector<ChangeString> change_strs = ChangeString::GetAnyRepresentations(str);
+  if (change_strs.empty()) {
+    Utility::DebugLog("'%s' is not a number", str.c_str());
+    return false;
+  }
+  Utility::DebugLog("Starting memory patching... (mode: %s, any %s)", GetModeString(mode).c_str(), str.c_str());
+  bool ret = RunProcess([&]() {
+    if (mode == Patcher::Mode::LOOKUP || mode == Patcher::Mode::COUNT) {
+      return LookUpMulti(change_strs, mode == Patcher::Mode::COUNT);
+    } else if (mode == Patcher::Mode::FILTER) {
+      return FilterAny(change_strs);
+    }
+    Utility::DebugLog("any can be used only with lookup, filter and count");
+    return false;
+  });
+  if (!ret) {
+    return false;
+  }
+  Utility::DebugLog("Please Input Command");
+  return true;
+}
+
+bool Patcher::MultiLookUp(const std::string &command, std::stringstream &sin) {
+  std::string type, str;
+  std::vector<ChangeString> change_strs;
+  while (sin >> type) {
+    if (!(sin >> str)) {
+      return false;
+    }
+    ChangeString change_str;
+    if (!change_str.Init(type, str)) {
+      Utility::DebugLog("%s is wrong type", type.c_str());
+      return false;
+    }
+    if (change_str.IsFuzzy() || change_str.HasMask()) {
+      Utility::DebugLog("%s can't be used with multi_lookup", type.c_str());
+      return false;
+    }
+    change_strs.push_back(change_str);
+  }
+  if (change_strs.empty()) {
+    return false;
+  }
+  Utility::DebugLog("Starting memory patching... (mode: multi_lookup, %zd rules)", change_strs.size());
+  if (!RunProcess([&]() { return LookUpMulti(change_strs); })) {
+    return false;
+  }
+  Utility::DebugLog("Please Input Command");
+  return true;
+}
+
 bool Patcher::PairFilter(const std::string &command, std::stringstream &sin) {
   std::string type, str;
   int store_size;
@@ -85,53 +180,66 @@ bool Patcher::PairFilter(const std::string &command, std::stringstream &sin) {
     return false;
   }
 
-  std::vector<TargetAddress> prev_addr_set = addr_set_;
   ChangeString change_str;
   if (!change_str.Init(type, str)) {
     Utility::DebugLog("%s is wrong type", type.c_str());
     return false;
   }
+  // 書き出されていても読み直さずにそのまま使う
+  const CandidateSet prev_addr_set = std::move(addr_set_);
+  addr_set_.Clear();
   if (!Process(Mode::LOOKUP, change_str)) {
     return false;
   }
 
-  std::vector<std::pair<size_t, TargetAddress>> addr_dists;
-  sort(prev_addr_set.begin(), prev_addr_set.end());
-  sort(addr_set_.begin(), addr_set_.end());
-  {
-    // 尺取りメソッドでアドレス間の一番近い距離を求める
+  // 距離と、prev_addr_setでの番号
+  std::vector<std::pair<size_t, size_t>> addr_dists;
+  if (!addr_set_.Empty()) {
+    // どちらもアドレスの昇順に並んでいるので、尺取りメソッドでアドレス間の一番近い距離を求める
     auto it2 = addr_set_.begin();
-    for (auto it1 = prev_addr_set.begin(); it1 != prev_addr_set.end(); it1++) {
-      size_t dist = 1e+9;
+    for (auto it1 = prev_addr_set.begin(); it1 != prev_addr_set.end(); ++it1) {
+      size_t dist = Address(it1->address).Dist(Address(it2->address));
       while (true) {
-        auto nit2 = it2 + 1;
-        if (nit2 == addr_set_.end()) {
+        auto nit2 = it2;
+        if (++nit2 == addr_set_.end()) {
           break;
         }
-        size_t ndist = it1->GetAddress().Dist(nit2->GetAddress());
+        size_t ndist = Address(it1->address).Dist(Address(nit2->address));
         if (ndist >= dist) {
           break;
         }
         dist = ndist;
         it2 = nit2;
       }
-      addr_dists.emplace_back(dist, *it1);
+      addr_dists.emplace_back(dist, it1->index);
     }
   }
   std::sort(addr_dists.begin(), addr_dists.end());
 
-  addr_set_.clear();
+  // 残すものはprev_addr_setと同じくアドレスの昇順に並べる
+  std::vector<size_t> kept;
   const int MAX_OUTPUT_SIZE = store_size + 10;
   int output_cnt = 0;
   for (auto it = addr_dists.begin(); it != addr_dists.end() && output_cnt < MAX_OUTPUT_SIZE; it++, output_cnt++) {
     size_t dist = it->first;
-    const TargetAddress &addr = it->second;
-    if ((int)addr_set_.size() < store_size) {
-      addr_set_.emplace_back(addr);
+    if ((int)kept.size() < store_size) {
+      kept.push_back(it->second);
     }
-    Utility::DebugLog("Dist: %zd, Address: %zx", dist, addr.GetAddress().to_i());
+    Utility::DebugLog("Dist: %zd, Address: %zx", dist, prev_addr_set.GetAddress(it->second));
   }
-  Utility::DebugLog("Result Address: %d", (int)addr_set_.size());
+  std::sort(kept.begin(), kept.end());
+  const size_t budget = addr_set_.GetBudget();
+  addr_set_ = prev_addr_set.EmptyCopy();
+  addr_set_.SetBudget(budget);
+  auto kept_it = kept.begin();
+  for (auto it = prev_addr_set.begin(); it != prev_addr_set.end() && kept_it != kept.end(); ++it) {
+    if (it->index == *kept_it) {
+      addr_set_.PushFrom(prev_addr_set, it->index, it->address);
+      kept_it++;
+    }
+  }
+  addr_set_.Shrink();
+  Utility::DebugLog("Result Address: %d", (int)addr_set_.Size());
 
   Utility::DebugLog("");
   Utility::DebugLog("Please Input Command");
@@ -150,11 +258,15 @@ bool Patcher::Replace(const std::string &command, std::stringstream &sin) {
     Utility::DebugLog("%s %s is not same length or wrong type", string_type.c_str(), after.c_str());
     return false;
   }
+  if (change_str.HasMask()) {
+    Utility::DebugLog("?? can't be used for writing");
+    return false;
+  }
 
   if (!memory_->Attach() || !CreateRangeSet()) {
     return false;
   }
-  TargetAddress address(Range::Fit(range_set_, Address(start)), change_str);
+  TargetAddress address(Range::Fit(range_index_, Address(start)), change_str);
   if (address.GetAddress().to_i() == 0) {
     Utility::DebugLog("Target Address is over the memory range");
     return false;
@@ -174,11 +286,15 @@ bool Patcher::Freeze(const std::string &command, std::stringstream &sin) {
     Utility::DebugLog("%s %s is not same length or wrong type", string_type.c_str(), after.c_str());
     return false;
   }
+  if (change_str.HasMask()) {
+    Utility::DebugLog("?? can't be used for writing");
+    return false;
+  }
 
   if (!memory_->Attach() || !CreateRangeSet()) {
     return false;
   }
-  TargetAddress address(Range::Fit(range_set_, Address(start)), change_str);
+  TargetAddress address(Range::Fit(range_index_, Address(start)), change_str);
   if (address.GetAddress().to_i() == 0) {
     Utility::DebugLog("Target Address is over the memory range");
     return false;
@@ -214,113 +330,170 @@ bool Patcher::Diff(const std::string &command, std::stringstream &sin) {
   };
   DiffMode mode = temp[mode_str];
   if (mode == DiffMode::LOWER || mode == DiffMode::UPPER || mode == DiffMode::SAME || mode == DiffMode::CHANGE) {
-    range_set_.clear();
     if (!memory_->Attach() || !CreateRangeSet()) {
       return false;
     }
 
+    // 書き込まれたページを全て集めてから、値を読む前にsoft-dirtyを消す
+    // 比べている間の書き込みは次のdiffで書き込まれたページとして拾える
+    const bool dirty_tracking = dirty_tracking_;
+    std::vector<std::vector<Range>> dirty_spans; // snapshot_の各Rangeの中で書き込まれた範囲
+    std::vector<Range> dirty;
+    if (dirty_tracking) {
+      if (snapshot_) {
+        for (const SnappedRange &sr : *snapshot_) {
+          dirty_spans.emplace_back();
+          Range range = Range::Fit(range_index_, sr.range());
+          if (range.GetStart().to_i() != 0) {
+            memory_->GetDirtyRanges(range, dirty_spans.back());
+          }
+        }
+      } else {
+        for (RangeSet::const_iterator it = range_set_.begin(); it != range_set_.end(); ++it) {
+          memory_->GetDirtyRanges(*it, dirty);
+        }
+      }
+      dirty_tracking_ = memory_->ClearSoftDirty();
+    }
+
     if (snapshot_) {
-      addr_set_.clear();
-      for (SnappedRange sr : *snapshot_) {
-        Range range = Range::Fit(range_set_, sr.range());
+      addr_set_.ResetValues(Converter::Type::INT_LITTLE_ENDIAN, 4);
+      // 新しい値だけをこの大きさずつ読み込んで、スナップショットのページと比べる
+      const size_t chunk_size = std::max((size_t)4096, scan_budget_ & ~(size_t)4095);
+      std::unique_ptr<uint8_t[]> new_memory;
+      const std::unique_ptr<uint8_t[]> scratch = std::make_unique<uint8_t[]>(Snapshot::PAGE);
+      size_t snapped_index = 0;
+      for (const SnappedRange &sr : *snapshot_) {
+        const size_t index = snapped_index++;
+        Range range = Range::Fit(range_index_, sr.range());
         if (range.GetStart().to_i() == 0)
           continue;
 
         size_t start = range.GetStart().to_i();
-        // size_t end = range.GetEnd().to_i();
         size_t n = range.Size();
+        // Fitで先頭が削られた場合は、その分だけ古いデータの読み込み位置をずらす
+        size_t old_offset = start - sr.range().GetStart().to_i();
+        if (!new_memory) {
+          new_memory = std::make_unique<uint8_t[]>(chunk_size);
+        }
 
-        const std::unique_ptr<uint8_t[]> old_memory = sr.data();
-        const std::unique_ptr<uint8_t[]> new_memory = std::make_unique<uint8_t[]>(n);
-        memory_->Read(new_memory.get(), range);
-
-        for (size_t i = 0; i < n; i += 4) {
-          int old_value = *(int *)(old_memory.get() + i);
-          int new_value = *(int *)(new_memory.get() + i);
-          // ChangeStringを中で作ってるのは数倍くらい速度が変わるため
-          if (mode == DiffMode::UPPER && old_value < new_value) {
-            ChangeString change_str(new_value);
-            addr_set_.emplace_back(Address(start + i), change_str);
-          } else if (mode == DiffMode::LOWER && old_value > new_value) {
-            ChangeString change_str(new_value);
-            addr_set_.emplace_back(Address(start + i), change_str);
-          } else if (mode == DiffMode::SAME && old_value == new_value) {
-            ChangeString change_str(new_value);
-            addr_set_.emplace_back(Address(start + i), change_str);
-          } else if (mode == DiffMode::CHANGE && old_value != new_value) {
-            ChangeString change_str(new_value);
-            addr_set_.emplace_back(Address(start + i), change_str);
-          } else {
-            // nop
+        // startからiバイト目の古い値、0のページや圧縮していないページはmmapした領域を直接指す
+        // 圧縮したページはscratchに展開するので、同じページを続けて読む間は展開し直さない
+        size_t old_page = SIZE_MAX;
+        const uint8_t *old_data = nullptr;
+        auto old_memory = [&](size_t i) {
+          const size_t x = old_offset + i;
+          if (x / Snapshot::PAGE != old_page) {
+            old_page = x / Snapshot::PAGE;
+            old_data = sr.page(old_page, scratch.get());
           }
-        }
-      }
-      snapshot_.reset();
-    } else {
-      const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(4);
-      int cnt = 0;
-      auto parent_range_it = range_set_.begin();
-      for (auto it = addr_set_.begin(); it != addr_set_.end(); it++) {
-        // TODO 関数化してFilterと合わせる
-        ChangeString change_str = it->GetChangeString();
-        size_t start = it->GetAddress().to_i();
-        size_t end = it->GetAddress().to_i() + change_str.Size();
-        if (end - start != 4) {
-          Utility::DebugLog("Target Rage is not 4: %zx-%zx (%d)", start, end, end - start);
-          continue;
-        }
+          return old_data + x % Snapshot::PAGE;
+        };
+
+        // startからのオフセットで[from, to)を読み込んで4バイト毎に比べる、fromは4バイト境界に揃っている
+        auto compare = [&](size_t from, size_t to) {
+          for (size_t p = from; p < to; p += chunk_size) {
+            const size_t q = std::min(to, p + chunk_size);
+            // 読めない所は0で埋められるので比べずに飛ばす、unreadableはアドレス順に並んでいる
+            std::vector<Range> unreadable;
+            memory_->Read(new_memory.get(), Range(start + p, start + q, range.GetComment()), &unreadable);
+            auto hole = unreadable.begin();
+            for (size_t i = p; i + 4 <= q; i += 4) {
+              while (hole != unreadable.end() && hole->GetEnd().to_i() <= start + i) {
+                hole++;
+              }
+              if (hole != unreadable.end() && hole->GetStart().to_i() < start + i + 4) {
+                continue;
+              }
+              int old_value = *(const int *)old_memory(i);
+              int new_value = *(const int *)(new_memory.get() + (i - p));
+              if ((mode == DiffMode::UPPER && old_value < new_value) ||
+                  (mode == DiffMode::LOWER && old_value > new_value) ||
+                  (mode == DiffMode::SAME && old_value == new_value) ||
+                  (mode == DiffMode::CHANGE && old_value != new_value)) {
+                addr_set_.PushValue(start + i, new_memory.get() + (i - p));
+              }
+            }
+          }
+        };
+        // 書き込まれていないページは値が変わっていないので、sameなら読まずに全て拾う
+        auto push_same = [&](size_t from, size_t to) {
+          if (mode != DiffMode::SAME) {
+            return;
+          }
+          for (size_t i = from; i + 4 <= to; i += 4) {
+            addr_set_.PushValue(start + i, old_memory(i));
+          }
+        };
 
-        while (parent_range_it != range_set_.end() && parent_range_it->GetEnd().to_i() < start) {
-          parent_range_it++;
-        }
-        if (parent_range_it == range_set_.end() || !parent_range_it->IsSuperset(Range(start, end, ""))) {
-          continue;
-        }
-        size_t s = -1;
-        if (addr_set_.size() < 10000) {
-          s = memory_->Read(temp_p.get(), Range(start, end, parent_range_it->GetComment()));
+        // 比較する範囲、soft-dirtyが使える場合は書き込まれたページだけを読み直して比較する
+        std::vector<Range> spans;
+        if (dirty_tracking) {
+          spans.swap(dirty_spans[index]);
         } else {
-          // open, readのsyscallが重いので、個数が多い場合はキャッシュ付きでやる
-          s = memory_->ReadWithCache(temp_p.get(), Range(start, end, parent_range_it->GetComment()), *parent_range_it);
+          spans.push_back(range);
         }
-        if (s != end - start) {
-          continue;
+        size_t next = 0;
+        for (auto it = spans.begin(); it != spans.end(); it++) {
+          // 4バイト境界に揃える
+          size_t span_start = (it->GetStart().to_i() - start) & ~(size_t)3;
+          size_t span_end = it->GetEnd().to_i() - start;
+          push_same(next, span_start);
+          compare(span_start, span_end);
+          next = span_end;
         }
-
-        int old_value = *(int *)change_str.GetRawValue().data();
-        int new_value = *(int *)temp_p.get();
-        TargetAddress target_address(it->GetAddress(), ChangeString(new_value));
-        if (mode == DiffMode::UPPER && old_value < new_value) {
-          addr_set_[cnt++] = target_address;
-        } else if (mode == DiffMode::LOWER && old_value > new_value) {
-          addr_set_[cnt++] = target_address;
-        } else if (mode == DiffMode::SAME && old_value == new_value) {
-          addr_set_[cnt++] = target_address;
-        } else if (mode == DiffMode::CHANGE && old_value != new_value) {
-          addr_set_[cnt++] = target_address;
-        } else {
-          // nop
+        if (dirty_tracking) {
+          push_same(next, n);
         }
       }
-      addr_set_.resize(cnt);
+      addr_set_.Shrink();
+      snapshot_.reset();
+    } else {
+      CandidateSet next;
+      next.ResetValues(Converter::Type::INT_LITTLE_ENDIAN, 4);
+      FilterTargets(4, dirty_tracking ? &dirty : nullptr, next,
+                    [&](size_t index, size_t address, const uint8_t *value, CandidateSet &kept) {
+                      if (addr_set_.GetSize(index) != 4) {
+                        Utility::DebugLog("Target Rage is not 4: %zx (%d)", address, (int)addr_set_.GetSize(index));
+                        return;
+                      }
+                      if (value == nullptr) {
+                        // 書き込まれていないので値は変わっていない
+                        if (mode == DiffMode::SAME) {
+                          kept.PushValue(address, addr_set_.GetValue(index));
+                        }
+                        return;
+                      }
+
+                      int old_value = *(int *)addr_set_.GetValue(index);
+                      int new_value = *(int *)value;
+                      if ((mode == DiffMode::UPPER && old_value < new_value) ||
+                          (mode == DiffMode::LOWER && old_value > new_value) ||
+                          (mode == DiffMode::SAME && old_value == new_value) ||
+                          (mode == DiffMode::CHANGE && old_value != new_value)) {
+                        kept.PushValue(address, value);
+                      }
+                    });
     }
-    Utility::DebugLog("Found! %zd address", addr_set_.size());
+    Utility::DebugLog("Found! %zd address", addr_set_.Size());
   } else if (mode == DiffMode::START) {
-    snapshot_ = std::make_unique<Snapshot>();
+    snapshot_.reset();
     if (!memory_->Attach() || !CreateRangeSet()) {
       return false;
     }
-
-    for (RangeSet::const_iterator it = range_set_.begin(); it != range_set_.end(); ++it) {
-      size_t n = it->Size();
-      const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
-      memory_->Read(temp_p.get(), *it);
-      snapshot_->push_back(*it, temp_p.get());
+    // スナップショットを読み込む前に消しておけば、読み込み中の書き込みも拾える
+    dirty_tracking_ = soft_dirty_ && memory_->ClearSoftDirty();
+    if (soft_dirty_ && !dirty_tracking_) {
+      Utility::DebugLog("soft-dirty is not available, diff reads all memory");
+    }
+    if (!CreateSnapshot()) {
+      return false;
     }
     Utility::DebugLog("snapshot created!");
   } else if (mode == DiffMode::END) {
     Utility::DebugLog("snapshot done! Use change command.");
     snapshot_.reset();
+    dirty_tracking_ = false;
   } else {
     Utility::DebugLog("usage: diff [start|end|upper|lower|same|change]");
   }
@@ -343,6 +516,81 @@ bool Patcher::Scope(const std::string &command, std::stringstream &sin) {
   Utility::DebugLog("Now scope is '%s'", range_scope_.c_str());
   return true;
 }
+bool Patcher::Set(const std::string &command, std::stringstream &sin) {
+  std::string key, value;
+  if (!(sin >> key)) {
+    Utility::DebugLog("verbose: %d", (int)verbose_);
+    Utility::DebugLog("scan_budget: %zd", scan_budget_);
+    Utility::DebugLog("sparse: %d", (int)sparse_);
+    Utility::DebugLog("cache_budget: %zd", memory_->GetCache().GetBudget());
+    Utility::DebugLog("candidate_budget: %zd", addr_set_.GetBudget());
+    Utility::DebugLog("soft_dirty: %d", (int)soft_dirty_);
+    Utility::DebugLog("threads: %zd", threads_);
+    Utility::DebugLog("align: %zd", align_);
+    Utility::DebugLog("fuzzy_below: %g", fuzzy_below_);
+    Utility::DebugLog("fuzzy_above: %g", fuzzy_above_);
+    Utility::DebugLog("fuzzy_ulp: %zd", fuzzy_ulp_);
+    Utility::DebugLog("limit: %zd", limit_);
+    Utility::DebugLog("read_plan: %s", ReadPlanner::GetStrategyName(read_planner_.GetForced()));
+    return true;
+  }
+  if (!(sin >> value)) {
+    return false;
+  }
+  size_t size = 0;
+  if ((key == "scan_budget" || key == "cache_budget" || key == "candidate_budget") &&
+      !Utility::StringToSize(value, size)) {
+    Utility::DebugLog("%s must be a size (e.g. 4096, 64k, 16m)", key.c_str());
+    return false;
+  }
+  if (key == "verbose") {
+    verbose_ = atoi(value.c_str()) != 0;
+  } else if (key == "scan_budget") {
+    scan_budget_ = size;
+  } else if (key == "sparse") {
+    sparse_ = atoi(value.c_str()) != 0;
+  } else if (key == "cache_budget") {
+    memory_->SetCacheBudget(size);
+  } else if (key == "candidate_budget") {
+    // 見つかったアドレスをメモリ上に持つ上限、超えた分はSTORAGE_PATHのファイルに書き出す、0なら無制限
+    addr_set_.SetBudget(size);
+  } else if (key == "soft_dirty") {
+    soft_dirty_ = atoi(value.c_str()) != 0;
+  } else if (key == "threads") {
+    int threads = atoi(value.c_str());
+    if (threads < 1) {
+      Utility::DebugLog("threads must be 1 or more");
+      return false;
+    }
+    threads_ = threads;
+  } else if (key == "align") {
+    // 0なら型の大きさに揃える
+    align_ = strtoul(value.c_str(), nullptr, 10);
+  } else if (key == "fuzzy_below") {
+    fuzzy_below_ = atof(value.c_str());
+  } else if (key == "fuzzy_above") {
+    fuzzy_above_ = atof(value.c_str());
+  } else if (key == "fuzzy_ulp") {
+    // 0なら幅(fuzzy_below, fuzzy_above)を使う
+    fuzzy_ulp_ = strtoul(value.c_str(), nullptr, 10);
+  } else if (key == "limit") {
+    // 0なら全て見つける
+    limit_ = strtoul(value.c_str(), nullptr, 10);
+  } else if (key == "read_plan") {
+    // auto以外(point, page, full)にすると、filterで候補の密度に関わらずその読み方を使う
+    ReadPlanner::Strategy strategy;
+    if (!ReadPlanner::ParseStrategy(value, strategy)) {
+      Utility::DebugLog("read_plan must be auto, point, page or full");
+      return false;
+    }
+    read_planner_.SetForced(strategy);
+  } else {
+    Utility::DebugLog("setting '%s' is invalid", key.c_str());
+    return false;
+  }
+  Utility::DebugLog("Now %s is '%s'", key.c_str(), value.c_str());
+  return true;
+}
 bool Patcher::Save(const std::string &command, std::stringstream &sin) {
   std::string filename;
   std::string state_path = std::string(STORAGE_PATH) + "/mempatch_state.txt";
@@ -369,6 +617,8 @@ bool Patcher::Load(const std::string &command, std::stringstream &sin) {
   }
   DeSerialize(fp);
   fclose(fp);
+  // 読み込んだ値はsoft-dirtyを消した時点より古いかもしれない
+  dirty_tracking_ = false;
   return true;
 }
 
@@ -380,7 +630,7 @@ bool Patcher::Dump(const std::string &command, std::stringstream &sin) {
     return false;
   }
   if (memory_->Attach() && CreateRangeSet()) {
-    memory_->Dump(Range::Fit(range_set_, Range(start, start + len, "")));
+    memory_->Dump(Range::Fit(range_index_, Range(start, start + len, "")));
   } else {
     Utility::DebugLog("Failed Dumping");
   }
@@ -438,16 +688,16 @@ bool Patcher::OutputResult(FILE *fp) const {
     }
   }
 
-  fprintf(fp, "Address Set : %d\n", (int)addr_set_.size());
-  for (auto it = addr_set_.begin(); it != addr_set_.end(); it++) {
+  fprintf(fp, "Address Set : %d\n", (int)addr_set_.Size());
+  for (auto it = addr_set_.begin(); it != addr_set_.end(); ++it) {
     if (sizeof(size_t) == 4) {
-      fprintf(fp, "    %08zx : ", it->GetAddress().to_i());
+      fprintf(fp, "    %08zx : ", it->address);
     } else {
-      fprintf(fp, "    %016zx : ", it->GetAddress().to_i());
+      fprintf(fp, "    %016zx : ", it->address);
     }
-    fprintf(fp, "%s", it->GetChangeString().GetValue().c_str());
-    fprintf(fp, " (%s)", it->GetChangeString().GetTypeString().c_str());
-    fprintf(fp, " (%s)\n", it->GetAddress().GetComment(range_set_).c_str());
+    fprintf(fp, "%s", addr_set_.GetValueString(it->index).c_str());
+    fprintf(fp, " (%s)", addr_set_.GetRule(it->index).GetTypeString().c_str());
+    fprintf(fp, " (%s)\n", Address(it->address).GetComment(range_index_).c_str());
   }
 
   return true;
@@ -468,14 +718,83 @@ void Patcher::Exit() {
 // private
 //================================================================================
 
+// /proc/pid/mapsの1行、文字列は読み込んだ内容の中を指すだけでコピーしない
+struct MapsLine {
+  size_t start;
+  size_t end;
+  const char *permission;
+  const char *pathname;
+  size_t pathname_size;
+};
+
+static const char *SkipSpace(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  return p;
+}
+
+static const char *SkipField(const char *p, const char *end) {
+  while (p < end && *p != ' ' && *p != '\t') {
+    p++;
+  }
+  return SkipSpace(p, end);
+}
+
+static const char *ParseHex(const char *p, const char *end, size_t &value) {
+  value = 0;
+  for (; p < end; p++) {
+    if ('0' <= *p && *p <= '9') {
+      value = value * 16 + (*p - '0');
+    } else if ('a' <= *p && *p <= 'f') {
+      value = value * 16 + (*p - 'a' + 10);
+    } else if ('A' <= *p && *p <= 'F') {
+      value = value * 16 + (*p - 'A' + 10);
+    } else {
+      break;
+    }
+  }
+  return p;
+}
+
+/**
+ * [line, end) の1行を "start-end permission offset dev inode pathname" として切り出す
+ * pathnameは以前と同じく最初の空白までとする
+ */
+static bool ParseMapsLine(const char *line, const char *end, MapsLine &ret) {
+  const char *p = ParseHex(line, end, ret.start);
+  if (p == line || p == end || *p != '-') {
+    return false;
+  }
+  p = ParseHex(p + 1, end, ret.end);
+  p = SkipSpace(p, end);
+  if (end - p < 4 || ret.end < ret.start) {
+    return false;
+  }
+  ret.permission = p;
+  p = SkipField(p, end); // permission
+  p = SkipField(p, end); // offset
+  p = SkipField(p, end); // dev
+  p = SkipField(p, end); // inode
+  ret.pathname = p;
+  while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+    p++;
+  }
+  ret.pathname_size = p - ret.pathname;
+  return true;
+}
+
+static bool Contains(const MapsLine &line, const std::string &str) {
+  return std::search(line.pathname, line.pathname + line.pathname_size, str.begin(), str.end()) !=
+         line.pathname + line.pathname_size;
+}
+
 /**
  * 各OS毎にマッピングされている読み書き可能なメモリ領域を列挙する
- *
- * @param rset 読み書き可能なメモリ領域
+ * mapsの内容もscopeも前回と変わっていなければ、range_set_とそれを元にしたキャッシュをそのまま使う
  */
 bool Patcher::CreateRangeSet() {
   assert(memory_->IsAttached());
-  char mmap_line[4096];
   const std::vector<std::string> ignore_list = {
   // 対象外のディレクトリ
 #if defined(_WIN32) || defined(_WIN64)
@@ -486,61 +805,144 @@ bool Patcher::CreateRangeSet() {
 #endif
   };
 
-  std::stringstream ss;
-  if (!memory_->GenerateMaps(ss)) {
+  if (!memory_->ReadMaps(maps_buffer_)) {
     Utility::DebugLog("process maps for pid '%d' can't be generated", memory_->GetPid());
     return false;
   }
-
-  std::string maps_content = ss.str();
-  std::istringstream iss(maps_content);
-
-  RangeSet prev_rset = range_set_;
-  range_set_.clear();
-
-  for (int i = 0; iss.getline(mmap_line, sizeof(mmap_line)); i++) {
-    std::stringstream sin(mmap_line);
-    std::string address, permission, offset, dev, inode, pathname;
-    pathname = "";
-    sin >> address >> permission >> offset >> dev >> inode >> pathname;
-    // 読み込み権限・書き込み権限があり、sharedでもファイルでない物のみ対象
-    for (auto it = ignore_list.begin(); it != ignore_list.end(); it++) {
-      if (pathname.find(*it) != std::string::npos) {
-        goto next;
-      }
+  const bool same_scope = range_scope_ == maps_scope_;
+  if (maps_buffer_ == maps_ && same_scope) {
+    return true;
+  }
+  maps_.swap(maps_buffer_);
+  maps_scope_ = range_scope_;
+
+  RangeSet prev_range_set;
+  prev_range_set.swap(range_set_);
+  const char *end = maps_.data() + maps_.size();
+  for (const char *line = maps_.data(); line < end;) {
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    MapsLine maps_line;
+    if (!ParseMapsLine(line, eol, maps_line)) {
+      line = eol + 1;
+      continue;
+    }
+    line = eol + 1;
+    bool ignored = false;
+    for (auto it = ignore_list.begin(); it != ignore_list.end() && !ignored; it++) {
+      ignored = Contains(maps_line, *it);
     }
-    if (!range_scope_.empty() && pathname.find(range_scope_) == std::string::npos) {
-      goto next;
+    if (ignored || (!range_scope_.empty() && !Contains(maps_line, range_scope_))) {
+      continue;
     }
+    // 読み込み権限・書き込み権限があり、sharedでもファイルでない物のみ対象
+    const char *permission = maps_line.permission;
     if (permission[0] == 'r' && permission[1] == 'w' && permission[3] != 's') {
-      size_t start, end;
-      sscanf(mmap_line, "%zx-%zx", &start, &end);
-      range_set_.insert(Range(start, end, pathname));
+      range_set_.insert(
+          Range(maps_line.start, maps_line.end, std::string(maps_line.pathname, maps_line.pathname_size)));
     }
-  next:;
+  }
+  range_index_.Build(range_set_);
+  // scopeを変えた場合は、マッピングが変わったわけではない
+  if (!prev_range_set.empty() && same_scope) {
+    ReportRangeSetDelta(prev_range_set);
   }
   return true;
 }
 
+/**
+ * 前回のrange_set_から増えた、消えた、大きさが変わったマッピングを表示する
+ * それらの範囲はキャッシュや読めなかったページの記録が古くなっているので捨てる
+ */
+void Patcher::ReportRangeSetDelta(const RangeSet &prev_range_set) {
+  size_t added = 0, removed = 0, resized = 0;
+  auto prev_it = prev_range_set.begin();
+  auto it = range_set_.begin();
+  while (prev_it != prev_range_set.end() || it != range_set_.end()) {
+    // 同じアドレスから始まっていても、名前が違えば別のマッピングに置き換わっている
+    const bool same_start = prev_it != prev_range_set.end() && it != range_set_.end() &&
+                            prev_it->GetStart() == it->GetStart() && prev_it->GetComment() == it->GetComment();
+    if (same_start) {
+      if (prev_it->GetEnd() != it->GetEnd()) {
+        if (verbose_) {
+          Utility::DebugLog("  ~ %zx-%zx -> %zx %s", prev_it->GetStart().to_i(), prev_it->GetEnd().to_i(),
+                            it->GetEnd().to_i(), it->GetComment().c_str());
+        }
+        memory_->InvalidateMapping(*prev_it);
+        memory_->InvalidateMapping(*it);
+        resized++;
+      }
+      prev_it++;
+      it++;
+    } else if (it == range_set_.end() || (prev_it != prev_range_set.end() && *prev_it < *it)) {
+      if (verbose_) {
+        Utility::DebugLog("  - %zx-%zx %s", prev_it->GetStart().to_i(), prev_it->GetEnd().to_i(),
+                          prev_it->GetComment().c_str());
+      }
+      memory_->InvalidateMapping(*prev_it);
+      removed++;
+      prev_it++;
+    } else {
+      if (verbose_) {
+        Utility::DebugLog("  + %zx-%zx %s", it->GetStart().to_i(), it->GetEnd().to_i(), it->GetComment().c_str());
+      }
+      memory_->InvalidateMapping(*it);
+      added++;
+      it++;
+    }
+  }
+  if (added + removed + resized > 0) {
+    Utility::DebugLog("Maps Changed: %zd added, %zd removed, %zd resized", added, removed, resized);
+  }
+}
+
 /**
  * LookUp, Filter, Changeのどれかを行い、計算結果のサマリーを表示する
  */
 bool Patcher::Process(const Mode mode, const ChangeString &change_str) {
-  bool ret = true;
-
-  const auto start_time = std::chrono::steady_clock::now();
   Utility::DebugLog("Starting memory patching... (mode: %s)", GetModeString(mode).c_str());
-  if (mode == Patcher::Mode::NOP) {
-  } else if (mode == Patcher::Mode::LOOKUP) {
-    ret &= LookUp(change_str);
-  } else if (mode == Patcher::Mode::FILTER) {
-    ret &= Filter(change_str);
-  } else if (mode == Patcher::Mode::CHANGE) {
-    ret &= ReplaceAll(change_str);
-  } else {
-    ret = false;
+  return RunProcess([&]() {
+    if (mode == Patcher::Mode::NOP) {
+      return true;
+    } else if (mode == Patcher::Mode::LOOKUP || mode == Patcher::Mode::COUNT) {
+      return LookUp(change_str, mode == Patcher::Mode::COUNT);
+    } else if (mode == Patcher::Mode::FILTER) {
+      return Filter(change_str);
+    } else if (mode == Patcher::Mode::CHANGE) {
+      if (change_str.HasMask()) {
+        Utility::DebugLog("?? can't be used for writing");
+        return false;
+      }
+      return ReplaceAll(change_str);
+    }
     Utility::DebugLog("mode is invalid");
-  }
+    return false;
+  });
+}
+
+bool Patcher::Process(const Mode mode, const NumericPredicate &predicate) {
+  Utility::DebugLog("Starting memory patching... (mode: %s, %s)", GetModeString(mode).c_str(),
+                    predicate.ToString().c_str());
+  return RunProcess([&]() {
+    if (mode == Patcher::Mode::LOOKUP || mode == Patcher::Mode::COUNT) {
+      return LookUpIf(predicate, mode == Patcher::Mode::COUNT);
+    } else if (mode == Patcher::Mode::FILTER) {
+      return FilterIf(predicate);
+    }
+    Utility::DebugLog("mode is invalid");
+    return false;
+  });
+}
+
+/**
+ * processを実行して、かかった時間と結果の数を表示する
+ */
+bool Patcher::RunProcess(const std::function<bool()> &process) {
+  const auto start_time = std::chrono::steady_clock::now();
+  read_planner_.Reset();
+  bool ret = process();
   last_process_time_ = time(nullptr);
   const auto end_time = std::chrono::steady_clock::now();
   double duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
@@ -550,6 +952,15 @@ bool Patcher::Process(const Mode mode, const ChangeString &change_str) {
     Utility::DebugLog("Memory: %.2lf MB", (double)GetMemorySize() / 1024.0 / 1024.0);
     Utility::DebugLog("Range Size: %d", GetRangeSetSize());
     Utility::DebugLog("Found Address: %d", GetTargetAddressSetSize());
+    if (verbose_) {
+      Utility::DebugLog("Address Set Memory: %.2lf MB, spilled %.2lf MB (bitmap regions: %zd)",
+                        (double)addr_set_.GetMemorySize() / 1024.0 / 1024.0,
+                        (double)addr_set_.GetSpilledSize() / 1024.0 / 1024.0, addr_set_.GetBitmapRegionCount());
+      const ReadCache &cache = memory_->GetCache();
+      Utility::DebugLog("Read Cache: hit %zd, miss %zd, eviction %zd", cache.GetHitCount(), cache.GetMissCount(),
+                        cache.GetEvictionCount());
+      read_planner_.Report();
+    }
   }
   Utility::DebugLog("");
 
@@ -559,108 +970,326 @@ bool Patcher::Process(const Mode mode, const ChangeString &change_str) {
 /**
  * change_strで指定された文字列を含むメモリアドレスを列挙する
  */
-bool Patcher::LookUp(const ChangeString &change_str) {
+bool Patcher::LookUp(const ChangeString &change_str, bool count_only) {
   if (!memory_->Attach() || !CreateRangeSet()) {
     return false;
   }
-  addr_set_.clear();
+  if (!count_only) {
+    addr_set_.Reset(change_str);
+  }
 
+  const size_t chstring_len = change_str.Size();
+  const uint8_t *raw_before = change_str.GetRawValue().data();
+  if (chstring_len == 0) {
+    return true;
+  }
+  if (change_str.IsFuzzy()) {
+    return LookUpIf(GetFuzzyPredicate(change_str), count_only);
+  }
+  // チャンクの境界をまたぐものも見つけられるように、パターン長-1だけ重ねて読み込む
+  RangeScanner scanner(*memory_, scan_budget_, chstring_len - 1, sparse_, threads_);
+  std::vector<RangeScanner::Chunk> plan;
   for (RangeSet::const_iterator it = range_set_.begin(); it != range_set_.end(); ++it) {
-    size_t start = it->GetStart().to_i();
-    size_t end = it->GetEnd().to_i();
-    size_t n = end - start;
-    const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
-    memory_->Read(temp_p.get(), *it);
-    size_t chstring_len = change_str.Size();
-    if (n < chstring_len) {
+    if (it->Size() < chstring_len) {
       continue;
     }
-    const uint8_t *raw_before = change_str.GetRawValue().data();
-    const uint8_t *str = temp_p.get();
+    scanner.Plan(*it, plan);
+  }
+  const PatternFinder finder(raw_before, chstring_len, change_str.HasMask() ? change_str.GetMask().data() : nullptr);
+  if (verbose_) {
+    Utility::DebugLog("Search Kernel: %s", PatternFinder::GetBackendName());
+  }
+  // チャンク毎に結果を保存して、前のチャンクから順にアドレス順に繋げる
+  // 1つのチャンクは1つのスレッドでしか処理されないので、Part(index)への書き込みは排他しなくて良い
+  CandidateMerger merger(addr_set_, plan.size(), GetLimit(), count_only);
+  scanner.ScanChunks(
+      plan,
+      [&](size_t index, const uint8_t *str, size_t n, size_t start, size_t owned) {
+        std::vector<size_t> find_index;
+        finder.Find(str, n, find_index);
+        if (count_only) {
+          merger.Count(index, std::lower_bound(find_index.begin(), find_index.end(), owned) - find_index.begin());
+          return;
+        }
+        for (auto it = find_index.begin(); it != find_index.end() && *it < owned && !merger.Enough(index); it++) {
+          merger.Part(index).Push(*it + start);
+        }
+      },
+      [&](size_t index) {
+        merger.Done(index);
+        if (merger.Full()) {
+          scanner.Stop();
+        }
+      });
+  FinishLookUp(plan, scanner, merger);
+  return true;
+}
 
-    std::vector<size_t> find_index;
-    if (change_str.GetType() == Converter::Type::FLOAT_FUZZY_LITTLE_ENDIAN) {
-      find_index = Utility::StrstrByFloatFuzzyLookup(str, raw_before, n, chstring_len);
-    } else {
-      find_index = Utility::StrstrByRollingHash(str, raw_before, n, chstring_len);
-    }
+/**
+ * addrsetのアドレスの値でchange_strに入ってないアドレスを除去する
+ */
+bool Patcher::Filter(const ChangeString &change_str) {
+  if (!memory_->Attach() || !CreateRangeSet()) {
+    return false;
+  }
+  if (change_str.IsFuzzy()) {
+    return FilterIf(GetFuzzyPredicate(change_str));
+  }
+  CandidateSet next;
+  next.Reset(change_str);
+  FilterTargets(change_str.Size(), nullptr, next,
+                [&](size_t index, size_t address, const uint8_t *value, CandidateSet &kept) {
+                  if (change_str.Match(value)) {
+                    kept.Push(address);
+                  }
+                });
+  return true;
+}
 
-    for (auto it = find_index.begin(); it != find_index.end(); it++) {
-      addr_set_.emplace_back(Address(*it + start), change_str);
-    }
+/**
+ * change_strsのいずれかを含むメモリアドレスを1回の走査で列挙する
+ * 見つかったアドレスには一致したchange_strを付ける
+ */
+bool Patcher::LookUpMulti(const std::vector<ChangeString> &change_strs, bool count_only) {
+  if (!memory_->Attach() || !CreateRangeSet()) {
+    return false;
+  }
+  if (!count_only) {
+    addr_set_.Reset(change_strs);
   }
 
+  std::vector<std::vector<uint8_t>> patterns;
+  for (auto it = change_strs.begin(); it != change_strs.end(); it++) {
+    patterns.push_back(it->GetRawValue());
+  }
+  const MultiPatternFinder finder(patterns);
+  const size_t max_size = finder.GetMaxSize();
+  if (max_size == 0) {
+    return true;
+  }
+  // 一番長いパターンがチャンクの境界をまたいでも見つけられるように重ねて読み込む
+  RangeScanner scanner(*memory_, scan_budget_, max_size - 1, sparse_, threads_);
+  std::vector<RangeScanner::Chunk> plan;
+  for (RangeSet::const_iterator it = range_set_.begin(); it != range_set_.end(); ++it) {
+    scanner.Plan(*it, plan);
+  }
+  CandidateMerger merger(addr_set_, plan.size(), GetLimit(), count_only);
+  std::vector<std::vector<size_t>> chunk_counts(plan.size(), std::vector<size_t>(change_strs.size(), 0));
+  scanner.ScanChunks(
+      plan,
+      [&](size_t index, const uint8_t *str, size_t n, size_t start, size_t owned) {
+        std::vector<MultiPatternFinder::Match> matches;
+        finder.Find(str, n, matches);
+        for (auto it = matches.begin(); it != matches.end() && it->index < owned && !merger.Enough(index); it++) {
+          if (count_only) {
+            merger.Count(index, 1);
+          } else {
+            merger.Part(index).Push(start + it->index, it->pattern);
+          }
+          chunk_counts[index][it->pattern]++;
+        }
+      },
+      [&](size_t index) {
+        merger.Done(index);
+        if (merger.Full()) {
+          scanner.Stop();
+        }
+      });
+  FinishLookUp(plan, scanner, merger);
+  std::vector<size_t> counts(change_strs.size(), 0);
+  for (auto it = chunk_counts.begin(); it != chunk_counts.end(); it++) {
+    for (size_t i = 0; i < counts.size(); i++) {
+      counts[i] += (*it)[i];
+    }
+  }
+  for (size_t i = 0; i < change_strs.size(); i++) {
+    Utility::DebugLog("  %s %s: %zd", change_strs[i].GetTypeString().c_str(), change_strs[i].GetValue().c_str(),
+                      counts[i]);
+  }
   return true;
 }
 
 /**
- * addrsetのアドレスの値でchange_strに入ってないアドレスを除去する
+ * addrsetのアドレスの値を、それぞれの型のchange_strsの値と比べて一致しないものを除去する
  */
-bool Patcher::Filter(const ChangeString &change_str) {
+bool Patcher::FilterAny(const std::vector<ChangeString> &change_strs) {
   if (!memory_->Attach() || !CreateRangeSet()) {
     return false;
   }
-  auto parent_range_it = range_set_.begin();
-  int cnt = 0;
-  for (auto it = addr_set_.begin(); it != addr_set_.end(); it++) {
-    size_t start = it->GetAddress().to_i();
-    size_t end = it->GetAddress().to_i() + change_str.Size();
-    // キャッシュ付きでやるために元々あったRangeを探す
-    while (parent_range_it != range_set_.end() && parent_range_it->GetEnd().to_i() < start) {
-      parent_range_it++;
+  std::map<Converter::Type, size_t> by_type;
+  for (size_t i = 0; i < change_strs.size(); i++) {
+    by_type[change_strs[i].GetType()] = i;
+  }
+  CandidateSet next;
+  next.Reset(change_strs);
+  FilterTargets(0, nullptr, next, [&](size_t index, size_t address, const uint8_t *value, CandidateSet &kept) {
+    auto it = by_type.find(addr_set_.GetType(index));
+    if (it == by_type.end()) {
+      return;
     }
-    if (parent_range_it == range_set_.end() || !parent_range_it->IsSuperset(Range(start, end, ""))) {
-      continue;
+    const ChangeString &change_str = change_strs[it->second];
+    if (change_str.Size() == addr_set_.GetSize(index) &&
+        memcmp(value, change_str.GetRawValue().data(), change_str.Size()) == 0) {
+      kept.Push(address, it->second);
     }
+  });
+  return true;
+}
 
-    const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(change_str.Size());
-    size_t s = -1;
-    if (addr_set_.size() < 10000) {
-      s = memory_->Read(temp_p.get(), Range(start, end, parent_range_it->GetComment()));
-    } else {
-      // open, readのsyscallが重いので、個数が多い場合はキャッシュ付きでやる
-      s = memory_->ReadWithCache(temp_p.get(), Range(start, end, parent_range_it->GetComment()), *parent_range_it);
-    }
-    if (change_str.GetType() == Converter::Type::FLOAT_FUZZY_LITTLE_ENDIAN) {
-      float min = 0.0f;
-      memcpy((char *)&min, change_str.GetRawValue().data(), 4);
-      float max = min + 1.05f;
-      min = min - 0.55f; // 四捨五入のケース対応
-      float v = 0.0f;
-      memcpy((uint8_t *)&v, temp_p.get(), 4);
-
-      if (v >= min && v <= max) {
-        if (cnt < 20)
-          Utility::DebugLog("From:%f, To:%f, Value:%f", min, max, v);
-        if (cnt == 20)
-          Utility::DebugLog(" and more...");
-        addr_set_[cnt++] = TargetAddress(it->GetAddress(), change_str);
-      }
-    } else {
-      if (s == change_str.Size() && memcmp(temp_p.get(), change_str.GetRawValue().data(), change_str.Size()) == 0) {
-        addr_set_[cnt++] = TargetAddress(it->GetAddress(), change_str);
-      }
+/**
+ * float_fuzzy, double_fuzzyの値から、設定された幅で探すための条件を作る
+ */
+NumericPredicate Patcher::GetFuzzyPredicate(const ChangeString &change_str) const {
+  NumericPredicate predicate;
+  predicate.InitFuzzy(change_str.GetType(), change_str.GetRawValue(), fuzzy_below_, fuzzy_above_, fuzzy_ulp_);
+  Utility::DebugLog("Fuzzy Range: %s", predicate.ToString().c_str());
+  return predicate;
+}
+
+/**
+ * predicateを満たす数値が入っているメモリアドレスを列挙する
+ * alignの倍数のアドレスだけを調べる
+ */
+bool Patcher::LookUpIf(const NumericPredicate &predicate, bool count_only) {
+  if (!memory_->Attach() || !CreateRangeSet()) {
+    return false;
+  }
+  const size_t size = predicate.Size();
+  if (!count_only) {
+    addr_set_.ResetValues(predicate.GetType(), size);
+  }
+  RangeScanner scanner(*memory_, scan_budget_, size - 1, sparse_, threads_);
+  std::vector<RangeScanner::Chunk> plan;
+  for (RangeSet::const_iterator it = range_set_.begin(); it != range_set_.end(); ++it) {
+    if (it->Size() < size) {
+      continue;
     }
+    scanner.Plan(*it, plan);
+  }
+  // 見つかった時の値も一緒に覚えておく
+  CandidateMerger merger(addr_set_, plan.size(), GetLimit(), count_only);
+  scanner.ScanChunks(
+      plan,
+      [&](size_t index, const uint8_t *str, size_t n, size_t start, size_t owned) {
+        std::vector<size_t> find_index;
+        predicate.Find(str, n, start, align_, find_index);
+        if (count_only) {
+          merger.Count(index, std::lower_bound(find_index.begin(), find_index.end(), owned) - find_index.begin());
+          return;
+        }
+        for (auto it = find_index.begin(); it != find_index.end() && *it < owned && !merger.Enough(index); it++) {
+          merger.Part(index).PushValue(start + *it, str + *it);
+        }
+      },
+      [&](size_t index) {
+        merger.Done(index);
+        if (merger.Full()) {
+          scanner.Stop();
+        }
+      });
+  FinishLookUp(plan, scanner, merger);
+  return true;
+}
+
+/**
+ * addrsetのアドレスの値でpredicateを満たさないアドレスを除去する
+ */
+bool Patcher::FilterIf(const NumericPredicate &predicate) {
+  if (!memory_->Attach() || !CreateRangeSet()) {
+    return false;
   }
-  addr_set_.resize(cnt);
+  const size_t size = predicate.Size();
+  CandidateSet next;
+  next.ResetValues(predicate.GetType(), size);
+  FilterTargets(size, nullptr, next, [&](size_t index, size_t address, const uint8_t *value, CandidateSet &kept) {
+    if (predicate.Test(value)) {
+      kept.PushValue(address, value);
+    }
+  });
   return true;
 }
 
 /**
- * addrsetのアドレスの値を置換する
+ * addrsetのアドレスの値をまとめて置換する
+ * 書き込みと確認の読み込みはそれぞれ少ないsyscallでまとめて行う
  */
 bool Patcher::ReplaceAll(const ChangeString &change_str) {
   if (!memory_->Attach() || !CreateRangeSet()) {
     return false;
   }
+  const size_t n = change_str.Size();
+  std::vector<IoRequest> requests;
+  requests.reserve(addr_set_.Size());
+  // 指定した値に書き換えられなかったアドレスは、Rangeから外れたものも含めて先頭から数個だけ表示する
+  size_t failed_cnt = 0;
+  auto parent_range_it = range_set_.begin();
+  for (auto it = addr_set_.begin(); it != addr_set_.end(); ++it) {
+    size_t start = it->address;
+    while (parent_range_it != range_set_.end() && parent_range_it->GetEnd().to_i() <= start) {
+      parent_range_it++;
+    }
+    if (parent_range_it == range_set_.end() || !parent_range_it->IsSuperset(Range(start, start + n, ""))) {
+      if (failed_cnt++ < 20) {
+        Utility::DebugLog("Replace is failed: %zx (out of the memory range)", start);
+      }
+      continue;
+    }
+    requests.push_back(IoRequest{start, n, nullptr, false});
+  }
+
+  // 書き込む値を並べておくと、連続したアドレスをまとめて書き込める
+  const std::unique_ptr<uint8_t[]> values = std::make_unique<uint8_t[]>(requests.size() * n);
+  const std::unique_ptr<uint8_t[]> before = std::make_unique<uint8_t[]>(requests.size() * n);
+  for (size_t i = 0; i < requests.size(); i++) {
+    memcpy(values.get() + i * n, change_str.GetRawValue().data(), n);
+  }
+
+  // Debug Log
+  if (verbose_) {
+    for (size_t i = 0; i < requests.size(); i++) {
+      requests[i].data = before.get() + i * n;
+    }
+    memory_->ReadVector(requests);
+    for (size_t i = 0; i < requests.size(); i++) {
+      std::vector<uint8_t> byte = Converter::RawByteToByte(requests[i].data, n);
+      const std::string &comment = Address(requests[i].address).GetComment(range_index_);
+      Utility::DebugLog("Change: %s(%s) -> %s(%s) (%s)", Converter::ByteToHex(byte).c_str(),
+                        Converter::GetString(change_str.GetType(), byte).c_str(), change_str.GetHexValue().c_str(),
+                        change_str.GetValue().c_str(), comment.c_str());
+    }
+  }
+
+  // Replace
+  for (size_t i = 0; i < requests.size(); i++) {
+    requests[i].data = values.get() + i * n;
+    requests[i].done = false;
+  }
+  memory_->WriteVector(requests);
+
+  // Error Check
+  for (size_t i = 0; i < requests.size(); i++) {
+    requests[i].data = before.get() + i * n;
+    requests[i].done = false;
+  }
+  memory_->ReadVector(requests);
   size_t cnt = 0;
-  for (auto it = addr_set_.begin(); it != addr_set_.end(); it++) {
-    if (Replace(*it, change_str)) {
+  for (size_t i = 0; i < requests.size(); i++) {
+    const size_t start = requests[i].address;
+    if (verbose_) {
+      memory_->Dump(Range::Fit(range_index_, Range(start - 16, start + n + 16, "")));
+    }
+    if (requests[i].done && memcmp(requests[i].data, change_str.GetRawValue().data(), n) == 0) {
       cnt++;
+    } else if (failed_cnt++ < 20) {
+      Utility::DebugLog("Replace is failed: %zx", start);
     }
   }
-  Utility::DebugLog("Replace Count: %d / %d", (int)cnt, (int)addr_set_.size());
-  return cnt == addr_set_.size();
+  Utility::DebugLog("Replace Count: %d / %d", (int)cnt, (int)addr_set_.Size());
+  if (cnt != addr_set_.Size()) {
+    Utility::DebugLog("*** Error ***\n*** Replace is failed!!! ***\n*** Please "
+                      "Change a device ***\n\n");
+  }
+  return cnt == addr_set_.Size();
 }
 
 /**
@@ -668,13 +1297,10 @@ bool Patcher::ReplaceAll(const ChangeString &change_str) {
  * 中身の整合性のチェックとかはしない
  */
 bool Patcher::Replace(const TargetAddress &target_address, const ChangeString &change_str) {
-  if (!memory_->Attach() || !CreateRangeSet()) {
-    return false;
-  }
   const Address &address = target_address.GetAddress();
   const size_t start = address.to_i();
   const size_t end = address.to_i() + change_str.Size();
-  const std::string &comment = address.GetComment(range_set_);
+  const std::string &comment = address.GetComment(range_index_);
   const size_t n = end - start;
   const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
 
@@ -689,7 +1315,7 @@ bool Patcher::Replace(const TargetAddress &target_address, const ChangeString &c
   memory_->Write(Range(start, end, comment), change_str.GetRawValue().data(), false);
 
   // Debug Log & Error Check
-  memory_->Dump(Range::Fit(range_set_, Range(start - 16, end + 16, comment)));
+  memory_->Dump(Range::Fit(range_index_, Range(start - 16, end + 16, comment)));
   memory_->Read(temp_p.get(), Range(start, end, comment));
   if (memcmp(temp_p.get(), change_str.GetRawValue().data(), n) != 0) {
     // 指定した値に書き換わってなかった場合はエラーを出力
@@ -700,6 +1326,320 @@ bool Patcher::Replace(const TargetAddress &target_address, const ChangeString &c
   return true;
 }
 
+/**
+ * range_set_の内容をsnapshot_に書き出す
+ * Rangeをscan_budget_をスレッド数で分けた大きさずつに分け、各スレッドが読み込んでは0や重複を除いて圧縮して書き込む
+ * sparseの場合は触られていないページは読み込まず、ファイルの0のままにする
+ */
+bool Patcher::CreateSnapshot() {
+  snapshot_ = std::make_unique<Snapshot>();
+  if (!snapshot_->open(range_set_)) {
+    snapshot_.reset();
+    return false;
+  }
+  // index番目のRangeのoffsetバイト目からrangeを書き込む
+  struct Piece {
+    size_t index;
+    size_t offset;
+    Range range;
+  };
+  const size_t piece_size = std::max((size_t)64 * 1024, (scan_budget_ / threads_) & ~(size_t)4095);
+  std::vector<Piece> pieces;
+  size_t index = 0;
+  for (auto it = range_set_.begin(); it != range_set_.end(); ++it, ++index) {
+    std::vector<Range> spans;
+    if (sparse_) {
+      memory_->GetResidentRanges(*it, spans);
+    } else {
+      spans.push_back(*it);
+    }
+    for (auto span = spans.begin(); span != spans.end(); span++) {
+      for (size_t p = span->GetStart().to_i(); p < span->GetEnd().to_i(); p += piece_size) {
+        const size_t q = std::min(span->GetEnd().to_i(), p + piece_size);
+        pieces.push_back(Piece{index, p - it->GetStart().to_i(), Range(p, q, it->GetComment())});
+      }
+    }
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  auto work = [&]() {
+    std::unique_ptr<uint8_t[]> buffer;
+    for (size_t i = next++; i < pieces.size() && !failed; i = next++) {
+      if (!buffer) {
+        buffer = std::make_unique<uint8_t[]>(piece_size);
+      }
+      const Piece &piece = pieces[i];
+      std::vector<Range> unreadable;
+      memory_->Read(buffer.get(), piece.range, &unreadable);
+      if (!snapshot_->write(piece.index, piece.offset, buffer.get(), piece.range.Size())) {
+        failed = true;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(threads_, pieces.size()); i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto it = workers.begin(); it != workers.end(); it++) {
+    it->join();
+  }
+  if (failed || !snapshot_->finish()) {
+    snapshot_.reset();
+    return false;
+  }
+  if (verbose_) {
+    snapshot_->report();
+  }
+  return true;
+}
+
+/**
+ * lookup, countの走査が終わったら呼ぶ
+ * countの場合はRange毎の数を表示する、planはrange_set_の順に作っているので並べて辿れば良い
+ */
+void Patcher::FinishLookUp(const std::vector<RangeScanner::Chunk> &plan, const RangeScanner &scanner,
+                           CandidateMerger &merger) {
+  merger.Finish();
+  read_planner_.CountScan(plan.size(), scanner.GetReadCount(), scanner.GetReadSize());
+  if (merger.IsCountOnly()) {
+    auto range_it = range_set_.begin();
+    for (size_t i = 0; i < plan.size();) {
+      while (range_it->GetEnd().to_i() <= plan[i].range.GetStart().to_i()) {
+        ++range_it;
+      }
+      size_t count = 0;
+      for (; i < plan.size() && plan[i].range.GetStart().to_i() < range_it->GetEnd().to_i(); i++) {
+        count += merger.GetCount(i);
+      }
+      if (count > 0) {
+        Utility::DebugLog("  %zx-%zx %s: %zd", range_it->GetStart().to_i(), range_it->GetEnd().to_i(),
+                          range_it->GetComment().c_str(), count);
+      }
+    }
+  }
+  if (scanner.IsStopped()) {
+    Utility::DebugLog("Stopped at limit %zd", limit_);
+  }
+  if (merger.IsCountOnly()) {
+    Utility::DebugLog("Count: %s%zd", scanner.IsStopped() ? "at least " : "", merger.GetTotal());
+  }
+  if (sparse_) {
+    Utility::DebugLog("Sparse Scan: read %.2lf MB of %.2lf MB", (double)scanner.GetReadSize() / 1024.0 / 1024.0,
+                      (double)scanner.GetScannedSize() / 1024.0 / 1024.0);
+  }
+}
+
+/**
+ * addr_set_を並列に読み込んで、filterがkeptに追加したものだけを元の順番のまま残す
+ * keptはaddr_set_と入れ替える集合の型やルールで、ブロック毎にその空のコピーに追加してから前から順に繋げる
+ * addr_set_が書き出されていてもmmapを先頭から順に読むだけなので、ブロックを小さく分けて結果を溜めすぎないようにする
+ * filterは別々のスレッドから呼ばれるが、addr_set_を読むのと、渡されたkeptに追加するのは自由
+ */
+void Patcher::FilterTargets(
+    size_t size, const std::vector<Range> *dirty, const CandidateSet &kept,
+    const std::function<void(size_t index, size_t address, const uint8_t *value, CandidateSet &kept)> &filter) {
+  // 少ない数を分けてもスレッドを作るコストの方が大きい
+  const size_t MIN_BLOCK_SIZE = 16384;
+  const size_t MAX_BLOCK_SIZE = 1024 * 1024;
+  const size_t n = addr_set_.Size();
+  const size_t block_size = std::min(MAX_BLOCK_SIZE, std::max(MIN_BLOCK_SIZE, (n + threads_ - 1) / threads_));
+  const size_t blocks = std::max((size_t)1, (n + block_size - 1) / block_size);
+
+  CandidateSet result = kept.EmptyCopy();
+  result.SetBudget(addr_set_.GetBudget());
+  CandidateMerger merger(result, blocks);
+  std::atomic<size_t> next_block(0);
+  auto work = [&]() {
+    for (size_t block = next_block++; block < blocks; block = next_block++) {
+      const size_t begin = block * block_size;
+      const size_t end = std::min(n, begin + block_size);
+      ReadTargets(size, dirty, begin, end, [&](size_t index, size_t address, const uint8_t *value) {
+        filter(index, address, value, merger.Part(block));
+      });
+      merger.Done(block);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(threads_, blocks); i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto it = workers.begin(); it != workers.end(); it++) {
+    it->join();
+  }
+  merger.Finish();
+  addr_set_ = std::move(result);
+}
+
+/**
+ * addr_set_[begin, end)の各アドレスからsizeバイトずつ読み込み、読み込めたものだけcallbackに渡す
+ * sizeが0の場合は、それぞれのアドレスに付いている値の大きさだけ読み込む
+ * dirtyが与えられた場合は、dirtyに含まれないアドレスは読み込まずにvalueをnullptrとして渡す
+ * 隣り合うRangeをまとめた区間毎に、read_planner_が候補の密度から読み方を決める
+ * callbackはindexの昇順で呼ばれる
+ */
+void Patcher::ReadTargets(size_t size, const std::vector<Range> *dirty, size_t begin, size_t end,
+                          const std::function<void(size_t index, size_t address, const uint8_t *value)> &callback) {
+  // 一度にまとめて読み込むアドレスの数
+  const size_t BATCH = 16384;
+  std::vector<IoRequest> requests;
+  std::vector<size_t> indexes;
+  size_t max_size = size;
+  if (size == 0) {
+    for (size_t i = begin; i < end; i++) {
+      max_size = std::max(max_size, addr_set_.GetSize(i));
+    }
+  }
+  const std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(BATCH * max_size);
+  requests.reserve(BATCH);
+  indexes.reserve(BATCH);
+
+  // requests[begin, 次のbegin)は[start, end)の区間に入る、endは隣り合うRangeが続く間は伸ばす
+  struct Region {
+    size_t begin;
+    size_t start;
+    size_t end;
+  };
+  std::vector<Region> regions;
+  std::vector<IoRequest> points;
+  std::vector<size_t> point_pos;
+  std::vector<uint8_t> span_buffer;
+  auto read_region = [&](const Region &region, size_t region_end) {
+    size_t bytes = 0;
+    size_t blocks = 0;
+    size_t last_block = 0;
+    const size_t first = requests[region.begin].address;
+    size_t last = first;
+    for (size_t i = region.begin; i < region_end; i++) {
+      bytes += requests[i].size;
+      last = std::max(last, requests[i].address + requests[i].size);
+      // 値がブロックをまたぐ場合は、またいだ先もそれぞれ数える
+      size_t from = requests[i].address / ReadCache::BLOCK_SIZE;
+      const size_t to = (requests[i].address + requests[i].size - 1) / ReadCache::BLOCK_SIZE;
+      if (blocks > 0) {
+        from = std::max(from, last_block + 1);
+      }
+      if (from <= to) {
+        blocks += to - from + 1;
+        last_block = to;
+      }
+    }
+    const ReadPlanner::Strategy strategy = read_planner_.Choose(region_end - region.begin, bytes, last - first, blocks);
+    if (strategy == ReadPlanner::POINT) {
+      // 他の区間のものとまとめてReadVectorで読む
+      for (size_t i = region.begin; i < region_end; i++) {
+        points.push_back(requests[i]);
+        point_pos.push_back(i);
+      }
+      read_planner_.Count(strategy, 1, region_end - region.begin, 0, bytes);
+    } else if (strategy == ReadPlanner::PAGE) {
+      const Range parent(region.start, region.end, "");
+      for (size_t i = region.begin; i < region_end; i++) {
+        IoRequest &request = requests[i];
+        request.done =
+            memory_->ReadWithCache(request.data, Range(request.address, request.address + request.size, ""), parent) ==
+            request.size;
+      }
+      read_planner_.Count(strategy, 1, region_end - region.begin, blocks, blocks * ReadCache::BLOCK_SIZE);
+    } else {
+      if (span_buffer.size() < last - first) {
+        span_buffer.resize(last - first);
+      }
+      std::vector<Range> unreadable;
+      memory_->Read(span_buffer.data(), Range(first, last, Address(first).GetComment(range_index_)), &unreadable);
+      auto unreadable_it = unreadable.begin();
+      for (size_t i = region.begin; i < region_end; i++) {
+        IoRequest &request = requests[i];
+        while (unreadable_it != unreadable.end() && unreadable_it->GetEnd().to_i() <= request.address) {
+          unreadable_it++;
+        }
+        request.done = unreadable_it == unreadable.end() ||
+                       request.address + request.size <= unreadable_it->GetStart().to_i();
+        memcpy(request.data, span_buffer.data() + (request.address - first), request.size);
+      }
+      read_planner_.Count(strategy, 1, region_end - region.begin, 1, last - first);
+    }
+  };
+
+  // 読み込まないものも含めてindexの昇順にcallbackを呼ぶ
+  std::vector<CandidateSet::Candidate> cleans;
+  auto flush = [&]() {
+    for (size_t i = 0; i < regions.size(); i++) {
+      read_region(regions[i], i + 1 < regions.size() ? regions[i + 1].begin : requests.size());
+    }
+    if (!points.empty()) {
+      memory_->ReadVector(points);
+      for (size_t i = 0; i < points.size(); i++) {
+        requests[point_pos[i]].done = points[i].done;
+      }
+      const size_t syscalls = (points.size() + ReadPlanner::IOVEC_BATCH - 1) / ReadPlanner::IOVEC_BATCH;
+      read_planner_.Count(ReadPlanner::POINT, 0, 0, syscalls, 0);
+    }
+    size_t clean_pos = 0;
+    for (size_t i = 0; i < requests.size(); i++) {
+      while (clean_pos < cleans.size() && cleans[clean_pos].index < indexes[i]) {
+        callback(cleans[clean_pos].index, cleans[clean_pos].address, nullptr);
+        clean_pos++;
+      }
+      if (requests[i].done) {
+        callback(indexes[i], requests[i].address, requests[i].data);
+      }
+    }
+    for (; clean_pos < cleans.size(); clean_pos++) {
+      callback(cleans[clean_pos].index, cleans[clean_pos].address, nullptr);
+    }
+    requests.clear();
+    indexes.clear();
+    cleans.clear();
+    regions.clear();
+    points.clear();
+    point_pos.clear();
+  };
+
+  auto parent_range_it = range_set_.begin();
+  std::vector<Range>::const_iterator dirty_it;
+  if (dirty) {
+    dirty_it = dirty->begin();
+  }
+  for (auto it = addr_set_.At(begin); it != addr_set_.end() && it->index < end; ++it) {
+    const size_t i = it->index;
+    size_t start = it->address;
+    size_t target_size = size == 0 ? addr_set_.GetSize(i) : size;
+    size_t last = start + target_size;
+    // 元々あったRangeに入っているものだけを対象にする
+    while (parent_range_it != range_set_.end() && parent_range_it->GetEnd().to_i() <= start) {
+      parent_range_it++;
+    }
+    if (parent_range_it == range_set_.end() || !parent_range_it->IsSuperset(Range(start, last, ""))) {
+      continue;
+    }
+    if (dirty) {
+      while (dirty_it != dirty->end() && dirty_it->GetEnd().to_i() <= start) {
+        dirty_it++;
+      }
+      if (dirty_it == dirty->end() || last <= dirty_it->GetStart().to_i()) {
+        cleans.push_back(*it);
+        continue;
+      }
+    }
+    const size_t parent_start = parent_range_it->GetStart().to_i();
+    const size_t parent_end = parent_range_it->GetEnd().to_i();
+    if (regions.empty() || regions.back().end < parent_start) {
+      regions.push_back(Region{requests.size(), parent_start, parent_end});
+    } else {
+      regions.back().end = std::max(regions.back().end, parent_end);
+    }
+    requests.push_back(IoRequest{start, target_size, buffer.get() + requests.size() * max_size, false});
+    indexes.push_back(i);
+    if (requests.size() == BATCH) {
+      flush();
+    }
+  }
+  flush();
+}
+
 bool Patcher::DumpAll(const std::string &filename) {
   if (memory_->Attach() && CreateRangeSet()) {
     FILE *fp = fopen(filename.c_str(), "wb");
@@ -719,15 +1659,26 @@ bool Patcher::DumpAll(const std::string &filename) {
   return true;
 }
 bool Patcher::DumpRange(FILE *fp, const Range &range) {
-  size_t n = range.Size();
-  const std::unique_ptr<uint8_t[]> temp_p = std::make_unique<uint8_t[]>(n);
-  memory_->Read(temp_p.get(), range);
-
-  if (fwrite(temp_p.get(), sizeof(uint8_t), n, fp) != n) {
-    return false;
-  }
-
-  return true;
+  bool ret = true;
+  // 読めなかった部分は0で埋めて、ファイル上の位置がずれないようにする
+  size_t next = range.GetStart().to_i();
+  auto write_zero = [&](size_t n) {
+    const uint8_t zero[4096] = {};
+    for (size_t i = 0; i < n && ret; i += sizeof(zero)) {
+      size_t s = std::min(sizeof(zero), n - i);
+      ret = fwrite(zero, sizeof(uint8_t), s, fp) == s;
+    }
+  };
+  RangeScanner scanner(*memory_, scan_budget_, 0);
+  scanner.Scan(range, [&](const uint8_t *data, size_t n, size_t address, size_t owned) {
+    write_zero(address - next);
+    if (ret && fwrite(data, sizeof(uint8_t), n, fp) != n) {
+      ret = false;
+    }
+    next = address + n;
+  });
+  write_zero(range.GetEnd().to_i() - next);
+  return ret;
 }
 std::unique_ptr<uint8_t[]> Patcher::LoadDumpRange(FILE *fp, const Range &range) {
   size_t n = range.Size();
@@ -742,7 +1693,7 @@ void Patcher::Serialize(FILE *fp) const {
   fprintf(fp, "_%d", memory_->GetPid());
   fprintf(fp, "_%d", last_process_time_);
   Utility::SetSerialize(fp, range_set_);
-  Utility::VectorSerialize(fp, addr_set_);
+  addr_set_.Serialize(fp);
   fprintf(stdout, "Success\n");
 }
 void Patcher::DeSerialize(FILE *fp) {
@@ -753,6 +1704,9 @@ void Patcher::DeSerialize(FILE *fp) {
   }
   fscanf(fp, "_%d", &last_process_time_);
   range_set_ = Utility::SetDeSerialize<class Range>(fp);
-  addr_set_ = Utility::VectorDeSerialize<class TargetAddress>(fp);
+  range_index_.Build(range_set_);
+  // 読み込んだrange_set_は今のmapsから作ったものではないので、次は必ず作り直す
+  maps_.clear();
+  addr_set_.DeSerialize(fp);
   fprintf(stdout, "Success\n");
 }
@@ -16,16 +16,23 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <functional>
 #include <memory>
 #include <sstream>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "Address.h"
+#include "CandidateSet.h"
 #include "ChangeString.h"
 #include "FreezeThread.h"
 #include "Memory.h"
+#include "NumericPredicate.h"
+#include "RangeScanner.h"
+#include "ReadPlanner.h"
 #include "Snapshot.h"
 
 class Patcher {
@@ -36,6 +43,7 @@ public:
     FILTER,
     CHANGE,
     DIFF,
+    COUNT,
   };
   static std::string GetModeString(Mode mode); // string -> Mode
   static Mode GetMode(const std::string &str); // Mode -> string
@@ -54,6 +62,8 @@ public:
 
   bool Clear(const std::string &command, std::stringstream &sin);
   bool Process(const std::string &command, std::stringstream &sin);
+  bool ProcessIf(const std::string &command, std::stringstream &sin);
+  bool MultiLookUp(const std::string &command, std::stringstream &sin);
   bool PairFilter(const std::string &command, std::stringstream &sin);
   bool Replace(const std::string &command, std::stringstream &sin);
   bool Diff(const std::string &command, std::stringstream &sin);
@@ -65,6 +75,7 @@ public:
   bool Exit(const std::string &command, std::stringstream &sin);
 
   bool Scope(const std::string &command, std::stringstream &sin);
+  bool Set(const std::string &command, std::stringstream &sin);
   bool Save(const std::string &command, std::stringstream &sin);
   bool Load(const std::string &command, std::stringstream &sin);
   bool DumpAll(const std::string &command, std::stringstream &sin);
@@ -84,7 +95,7 @@ public:
     return ret;
   }
   int GetRangeSetSize() const { return range_set_.size(); }
-  int GetTargetAddressSetSize() const { return addr_set_.size(); }
+  int GetTargetAddressSetSize() const { return addr_set_.Size(); }
 
   static void PrintCommandUsage() {
     fprintf(stderr, "PatcherCommand:\n");
@@ -95,6 +106,13 @@ public:
 
     fprintf(stderr, "  lookup [rule]            lookup memory under the rule\n");
     fprintf(stderr, "  filter [rule]            filter found address under the rule\n");
+    fprintf(stderr, "  lookup_if [predicate]    lookup numeric value under the predicate "
+                    "(e.g. lookup_if int between 90 110)\n");
+    fprintf(stderr, "  filter_if [predicate]    filter found address under the predicate\n");
+    fprintf(stderr, "  count [rule]             count matches per region without storing them\n");
+    fprintf(stderr, "  count_if [predicate]     count numeric matches per region without storing them\n");
+    fprintf(stderr, "  multi_lookup [rule]...   lookup several rules in one pass "
+                    "(e.g. multi_lookup int 100 float 100)\n");
     fprintf(stderr, "  pair_filter [rule] cnt   filter by nearest another "
                     "value (e.g. lookup HP and filter by MP)\n");
     fprintf(stderr, "  change [rule]            replace found address under the rule\n");
@@ -104,6 +122,7 @@ public:
 
     fprintf(stderr, "  scope [ascii]            set range scope (e.g. scope "
                     "[anon:libc_malloc])\n");
+    fprintf(stderr, "  set [key] [value]        change setting (e.g. set verbose 1)\n");
     fprintf(stderr, "  result                   output Lookup result\n");
     fprintf(stderr, "  dump [hexint] [hexint]   dump memory (e.g. dump "
                     "7f33f6963005 20) \n");
@@ -117,27 +136,76 @@ public:
     fprintf(stderr, "  #  comment\n");
     fprintf(stderr, "  // comment\n");
     ChangeString::PrintCommandUsage();
+    NumericPredicate::PrintCommandUsage();
   }
 
 private:
   void Init(int pid, bool without_ptrace) {
     last_process_time_ = -1;
+    verbose_ = false;
+    scan_budget_ = 32 * 1024 * 1024;
+    sparse_ = false;
+    soft_dirty_ = true;
+    dirty_tracking_ = false;
+    align_ = 0;
+    // 表示されている値が四捨五入や切り捨てされていても見つかるように
+    fuzzy_below_ = 0.55;
+    fuzzy_above_ = 1.05;
+    fuzzy_ulp_ = 0;
+    limit_ = 0;
+    threads_ = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+    addr_set_.SetBudget(256 * 1024 * 1024);
     memory_ = std::make_shared<Memory>(pid, without_ptrace);
   }
   bool CreateRangeSet();
+  void ReportRangeSetDelta(const RangeSet &prev_range_set);
   bool Process(const Mode mode, const ChangeString &change_str);
-  bool LookUp(const ChangeString &change_str);
+  bool Process(const Mode mode, const NumericPredicate &predicate);
+  bool ProcessAny(const Mode mode, const std::string &str);
+  bool RunProcess(const std::function<bool()> &process);
+  // count_onlyの場合はaddr_set_を変えずに、Range毎の数だけを表示する
+  bool LookUp(const ChangeString &change_str, bool count_only = false);
   bool Filter(const ChangeString &change_str);
+  bool LookUpMulti(const std::vector<ChangeString> &change_strs, bool count_only = false);
+  bool FilterAny(const std::vector<ChangeString> &change_strs);
+  bool LookUpIf(const NumericPredicate &predicate, bool count_only = false);
+  bool FilterIf(const NumericPredicate &predicate);
+  NumericPredicate GetFuzzyPredicate(const ChangeString &change_str) const;
   bool ReplaceAll(const ChangeString &change_str);
   bool Replace(const TargetAddress &target_address, const ChangeString &change_str);
+  bool CreateSnapshot();
+  size_t GetLimit() const { return limit_ == 0 ? SIZE_MAX : limit_; }
+  void FinishLookUp(const std::vector<RangeScanner::Chunk> &plan, const RangeScanner &scanner,
+                    CandidateMerger &merger);
+  void FilterTargets(size_t size, const std::vector<Range> *dirty, const CandidateSet &kept,
+                     const std::function<void(size_t index, size_t address, const uint8_t *value, CandidateSet &kept)>
+                         &filter);
+  void ReadTargets(size_t size, const std::vector<Range> *dirty, size_t begin, size_t end,
+                   const std::function<void(size_t index, size_t address, const uint8_t *value)> &callback);
 
   int last_process_time_;
   RangeSet range_set_;
-  std::vector<TargetAddress> addr_set_;
+  RangeIndex range_index_; // range_set_を二分探索で引くためのもの、range_set_を変えたら作り直す
+  std::string maps_;       // range_set_を作ったmapsの内容
+  std::string maps_scope_; // range_set_を作った時のrange_scope_
+  std::string maps_buffer_;
+  CandidateSet addr_set_;
   std::vector<std::unique_ptr<FreezeThread>> freeze_set_;
   std::shared_ptr<Memory> memory_;
   std::unique_ptr<Snapshot> snapshot_;
   std::string range_scope_;
+  bool verbose_;        // changeでアドレス毎のダンプを表示する
+  size_t scan_budget_;  // lookup, dumpallで一度に読み込むメモリの上限
+  bool sparse_;         // lookup, diff startで触られていないページを読み飛ばす
+  bool soft_dirty_;     // diffでsoft-dirtyビットを使って書き込まれたページだけを比較する
+  bool dirty_tracking_; // diff start以降、soft-dirtyビットで書き込みを追跡できている
+  size_t threads_;       // lookup, filterで使うスレッド数、1なら読み込みと走査を順番に行う
+  size_t align_;         // lookup_if, fuzzyで調べるアドレスの間隔、0なら型の大きさ
+  double fuzzy_below_;   // fuzzyで値より小さい側に許す幅
+  double fuzzy_above_;   // fuzzyで値より大きい側に許す幅
+  size_t fuzzy_ulp_;     // 0でなければ、幅の代わりに前後この数の表現可能な値までを許す
+  size_t limit_;         // lookup, countでこの数だけ見つけたら残りを読まずに終わる、0なら無制限
+  ReadPlanner read_planner_; // filterで候補をどう読むかを決め、lookupと合わせて読み方を数える
 
   bool DumpAll(const std::string &filename);
   bool DumpRange(FILE *fp, const Range &range);
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "RangeScanner.h"
+
+// チャンクが小さすぎるとsyscallの回数が増えるので下限を設ける
+static const size_t MIN_CHUNK_SIZE = 64 * 1024;
+
+RangeScanner::RangeScanner(const Memory &memory, size_t budget, size_t overlap, bool sparse, size_t threads)
+    : memory_(memory), overlap_(overlap), sparse_(sparse), threads_(std::max((size_t)1, threads)), scanned_size_(0),
+      read_size_(0), read_count_(0), capacity_(0), stopped_(false) {
+  // スレッド毎に処理中のバッファと待っているバッファが1つずつあれば、読み込みと走査が止まらない
+  slots_ = threads_ == 1 ? 1 : threads_ * 2;
+  size_t slot_budget = budget / slots_;
+  chunk_size_ = std::max(MIN_CHUNK_SIZE, slot_budget > overlap ? slot_budget - overlap : 0);
+}
+
+void RangeScanner::Scan(const Range &range, const Callback &callback) {
+  std::vector<Chunk> plan;
+  Plan(range, plan);
+  for (auto it = plan.begin(); it != plan.end(); it++) {
+    const size_t capacity = it->range.Size();
+    if (capacity_ < capacity) {
+      capacity_ = capacity;
+      buffer_.reset(new uint8_t[capacity_]);
+    }
+    std::vector<Range> unreadable;
+    memory_.Read(buffer_.get(), it->range, &unreadable);
+    Dispatch(buffer_.get(), *it, unreadable, callback);
+  }
+}
+
+void RangeScanner::Plan(const Range &range, std::vector<Chunk> &plan) {
+  scanned_size_ += range.Size();
+  if (!sparse_) {
+    PlanSpan(range, plan);
+    return;
+  }
+  // 触られていないページは0なので、データを持っているページだけを読み込む
+  std::vector<Range> resident;
+  memory_.GetResidentRanges(range, resident);
+  for (auto it = resident.begin(); it != resident.end(); it++) {
+    PlanSpan(*it, plan);
+  }
+}
+
+void RangeScanner::PlanSpan(const Range &range, std::vector<Chunk> &plan) {
+  read_size_ += range.Size();
+  const size_t start = range.GetStart().to_i();
+  const size_t n = range.Size();
+  for (size_t offset = 0; offset < n; offset += chunk_size_) {
+    size_t owned = std::min(chunk_size_, n - offset);
+    size_t size = std::min(chunk_size_ + overlap_, n - offset);
+    size_t address = start + offset;
+    plan.push_back(Chunk{Range(address, address + size, range.GetComment()), owned});
+  }
+}
+
+/**
+ * 読めなかった部分を除いて、読めた部分ごとにcallbackを呼ぶ
+ */
+void RangeScanner::Dispatch(const uint8_t *data, const Chunk &chunk, std::vector<Range> &unreadable,
+                            const Callback &callback) {
+  const size_t address = chunk.range.GetStart().to_i();
+  const size_t end = chunk.range.GetEnd().to_i();
+  const size_t owned_end = address + chunk.owned;
+  unreadable.emplace_back(end, end, "");
+  size_t p = address;
+  for (auto it = unreadable.begin(); it != unreadable.end(); it++) {
+    size_t q = it->GetStart().to_i();
+    if (p < q && p < owned_end) {
+      callback(data + (p - address), q - p, p, std::min(q, owned_end) - p);
+    }
+    p = std::max(p, it->GetEnd().to_i());
+  }
+}
+
+void RangeScanner::ScanChunks(const std::vector<Chunk> &plan, const ChunkCallback &callback,
+                              const DoneCallback &done) {
+  stopped_ = false;
+  if (plan.empty()) {
+    return;
+  }
+  size_t capacity = 0;
+  for (auto it = plan.begin(); it != plan.end(); it++) {
+    capacity = std::max(capacity, it->range.Size());
+  }
+  std::vector<Read> reads;
+  Coalesce(plan, capacity, reads);
+  if (threads_ == 1) {
+    // 1スレッドでは重ねられないので、読み込みと走査を順番に行う
+    if (capacity_ < capacity) {
+      capacity_ = capacity;
+      buffer_.reset(new uint8_t[capacity_]);
+    }
+    for (size_t i = 0; i < reads.size() && !stopped_; i++) {
+      std::vector<Range> unreadable;
+      memory_.Read(buffer_.get(), reads[i].range, &unreadable);
+      read_count_++;
+      DispatchRead(buffer_.get(), plan, reads[i], unreadable, callback, done);
+    }
+    return;
+  }
+
+  // slots_個のバッファを使い回す、空きが無ければ読み込み側が待つのでメモリはbudgetに収まる
+  struct Slot {
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t index; // readsの番号
+    std::vector<Range> unreadable;
+  };
+  const size_t slots = std::min(slots_, reads.size());
+  std::vector<Slot> ring(slots);
+  std::deque<Slot *> free_slots, filled_slots;
+  for (auto it = ring.begin(); it != ring.end(); it++) {
+    it->buffer.reset(new uint8_t[capacity]);
+    free_slots.push_back(&*it);
+  }
+  std::mutex mutex;
+  std::condition_variable cond;
+  // 読み込みはsyscallの中で待つことが多いので、スレッドを半分ずつに分ける
+  const size_t readers = std::max((size_t)1, threads_ / 2);
+  const size_t scanners = threads_ - readers;
+  size_t running_readers = readers;
+  std::atomic<size_t> next_read(0);
+
+  auto read = [&]() {
+    while (true) {
+      Slot *slot;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return !free_slots.empty(); });
+        slot = free_slots.front();
+        free_slots.pop_front();
+      }
+      const size_t i = stopped_ ? reads.size() : next_read++;
+      if (i >= reads.size()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_slots.push_back(slot);
+        running_readers--;
+        break;
+      }
+      slot->index = i;
+      slot->unreadable.clear();
+      memory_.Read(slot->buffer.get(), reads[i].range, &slot->unreadable);
+      read_count_++;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        filled_slots.push_back(slot);
+      }
+      cond.notify_all();
+    }
+    cond.notify_all();
+  };
+  auto scan = [&]() {
+    while (true) {
+      Slot *slot;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return !filled_slots.empty() || running_readers == 0; });
+        if (filled_slots.empty()) {
+          break;
+        }
+        slot = filled_slots.front();
+        filled_slots.pop_front();
+      }
+      // 止められた後に読み込まれていたものは捨てる
+      DispatchRead(slot->buffer.get(), plan, reads[slot->index], slot->unreadable, callback, done);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_slots.push_back(slot);
+      }
+      cond.notify_all();
+    }
+  };
+
+  // 呼び出し元のスレッドも走査に使う
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < readers; i++) {
+    workers.emplace_back(read);
+  }
+  for (size_t i = 1; i < scanners; i++) {
+    workers.emplace_back(scan);
+  }
+  scan();
+  for (auto it = workers.begin(); it != workers.end(); it++) {
+    it->join();
+  }
+}
+
+/**
+ * 前のチャンクの終わりから始まるチャンクは、合わせてcapacityに収まる間は1回の読み込みにまとめる
+ * mapsで隣り合うRange(.dataと.bss、分かれた[anon:libc_malloc]など)の小さいチャンクが1回のsyscallで読める
+ * 同じRangeの中のチャンクはoverlapだけ重なっているのでまとめない
+ * 読めなかった時に表示するコメントは先頭のチャンクのものになる
+ */
+void RangeScanner::Coalesce(const std::vector<Chunk> &plan, size_t capacity, std::vector<Read> &reads) {
+  for (size_t i = 0; i < plan.size(); i++) {
+    const size_t start = plan[i].range.GetStart().to_i();
+    const size_t end = plan[i].range.GetEnd().to_i();
+    if (!reads.empty()) {
+      Read &last = reads.back();
+      const size_t last_start = last.range.GetStart().to_i();
+      if (last.range.GetEnd().to_i() == start && end - last_start <= capacity) {
+        last.range = Range(last_start, end, last.range.GetComment());
+        last.last = i + 1;
+        continue;
+      }
+    }
+    reads.push_back(Read{i, i + 1, plan[i].range});
+  }
+}
+
+/**
+ * まとめて読み込んだdataを、元のチャンク毎にDispatchする
+ * 読めなかった範囲はチャンク毎に切り出して渡す
+ */
+void RangeScanner::DispatchRead(const uint8_t *data, const std::vector<Chunk> &plan, const Read &read,
+                                const std::vector<Range> &unreadable, const ChunkCallback &callback,
+                                const DoneCallback &done) {
+  const size_t read_start = read.range.GetStart().to_i();
+  std::vector<Range> chunk_unreadable;
+  for (size_t i = read.first; i < read.last && !stopped_; i++) {
+    const size_t start = plan[i].range.GetStart().to_i();
+    const size_t end = plan[i].range.GetEnd().to_i();
+    chunk_unreadable.clear();
+    for (auto it = unreadable.begin(); it != unreadable.end(); it++) {
+      const size_t p = std::max(start, it->GetStart().to_i());
+      const size_t q = std::min(end, it->GetEnd().to_i());
+      if (p < q) {
+        chunk_unreadable.emplace_back(p, q, "");
+      }
+    }
+    Dispatch(data + (start - read_start), plan[i], chunk_unreadable,
+             [&](const uint8_t *d, size_t size, size_t address, size_t owned) {
+               callback(i, d, size, address, owned);
+             });
+    if (done) {
+      done(i);
+    }
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "Address.h"
+#include "Memory.h"
+
+/**
+ * Rangeを固定サイズのチャンクに分け、使い回すバッファに読み込みながら走査する
+ * 隣り合うチャンクはoverlapバイトだけ重ねて読むので、境界をまたぐパターンも見つけられる
+ * 読めないページがあった場合は、その前後を別々にcallbackに渡す
+ * sparseの場合は、pagemapで実際にデータを持っているページだけを読み込む
+ * ScanChunksでは読み込み用のスレッドがリングバッファを埋め、走査用のスレッドがそれを処理するので
+ * syscallでのコピーと走査が重なる、各スレッドは次のチャンクを順番に取っていく
+ * 隣り合うRangeの小さいチャンクは1回の読み込みにまとめ、callbackにはチャンク毎に渡す
+ */
+class RangeScanner {
+public:
+  // data, size: 読み込んだチャンク, address: チャンクの先頭アドレス
+  // owned: このチャンクが担当するバイト数、これ以降から始まるものは次のチャンクで見つかる
+  typedef std::function<void(const uint8_t *data, size_t size, size_t address, size_t owned)> Callback;
+  // indexはPlanで作ったチャンクの通し番号、結果をindex毎に保存すればアドレス順に並べ直せる
+  typedef std::function<void(size_t index, const uint8_t *data, size_t size, size_t address, size_t owned)>
+      ChunkCallback;
+  // チャンクを処理し終わった時に呼ぶ、そのindexのcallbackはもう呼ばれない
+  typedef std::function<void(size_t index)> DoneCallback;
+
+  // 読み込む単位、rangeを読み込んで先頭からownedバイトの中で始まるものだけを拾う
+  struct Chunk {
+    Range range;
+    size_t owned;
+  };
+
+  RangeScanner() = delete;
+  RangeScanner(RangeScanner const &) = delete;
+  RangeScanner &operator=(RangeScanner const &) = delete;
+  // budgetはバッファ全体の上限で、スレッド数に応じた数のバッファに分けてからoverlapを引いた大きさがチャンクになる
+  RangeScanner(const Memory &memory, size_t budget, size_t overlap, bool sparse = false, size_t threads = 1);
+
+  void Scan(const Range &range, const Callback &callback);
+  // rangeをチャンクに分けてplanに追加する
+  void Plan(const Range &range, std::vector<Chunk> &plan);
+  // planのチャンクを読み込みと走査を重ねながら処理する
+  // threadsが2以上の場合callbackは複数のスレッドから呼ばれるが、1つのチャンクは1つのスレッドでしか処理されない
+  void ScanChunks(const std::vector<Chunk> &plan, const ChunkCallback &callback, const DoneCallback &done = nullptr);
+  // ScanChunksの途中で呼ぶと、まだ読み込んでいないチャンクを読まずに終わる、callbackやdoneから呼んで良い
+  void Stop() { stopped_ = true; }
+  bool IsStopped() const { return stopped_; }
+  size_t GetChunkSize() const { return chunk_size_; }
+  size_t GetScannedSize() const { return scanned_size_; } // 走査したRangeの合計サイズ
+  size_t GetReadSize() const { return read_size_; }       // 実際に読み込んだサイズ
+  size_t GetReadCount() const { return read_count_; }     // ScanChunksで読み込んだ回数
+
+private:
+  const Memory &memory_;
+  size_t chunk_size_;
+  size_t overlap_;
+  bool sparse_;
+  size_t threads_;
+  size_t slots_;
+  size_t scanned_size_;
+  size_t read_size_;
+  std::atomic<size_t> read_count_;
+  size_t capacity_; // 必要になった分だけbufferを確保する
+  std::unique_ptr<uint8_t[]> buffer_;
+  std::atomic<bool> stopped_;
+
+  // 1回で読み込む範囲、plan[first, last)のチャンクを含む
+  struct Read {
+    size_t first;
+    size_t last;
+    Range range;
+  };
+
+  void PlanSpan(const Range &range, std::vector<Chunk> &plan);
+  static void Coalesce(const std::vector<Chunk> &plan, size_t capacity, std::vector<Read> &reads);
+  void DispatchRead(const uint8_t *data, const std::vector<Chunk> &plan, const Read &read,
+                    const std::vector<Range> &unreadable, const ChunkCallback &callback, const DoneCallback &done);
+  static void Dispatch(const uint8_t *data, const Chunk &chunk, std::vector<Range> &unreadable,
+                       const Callback &callback);
+};
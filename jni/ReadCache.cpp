@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <string.h>
+
+#include "ReadCache.h"
+
+size_t ReadCache::Read(uint8_t *dest, const Range &src, const Range &parent_range, const Reader &reader) {
+  size_t address = src.GetStart().to_i();
+  const size_t end = src.GetEnd().to_i();
+  size_t ret = 0;
+  while (address < end) {
+    // ブロックはshared_ptrで持っているので、Evictされてもコピーが終わるまでは残る
+    BlockPtr block = Load(address & ~(BLOCK_SIZE - 1), parent_range, reader);
+    if (address < block->start || block->start + block->size <= address) {
+      // 読み込めなかった部分に入ったのでそこまでを返す
+      break;
+    }
+    size_t s = std::min(end, block->start + block->size) - address;
+    memcpy(dest + ret, block->data.get() + (address - block->start), s);
+    ret += s;
+    address += s;
+  }
+  return ret;
+}
+
+void ReadCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lru_.clear();
+  blocks_.clear();
+  used_ = 0;
+  generation_++;
+  ResetCounter();
+}
+
+void ReadCache::Invalidate(const Range &range) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation_++;
+  if (blocks_.empty() || range.Size() == 0) {
+    return;
+  }
+  const size_t last = (range.GetEnd().to_i() - 1) & ~(BLOCK_SIZE - 1);
+  for (size_t key = range.GetStart().to_i() & ~(BLOCK_SIZE - 1); key <= last; key += BLOCK_SIZE) {
+    Erase(key);
+  }
+}
+
+void ReadCache::SetBudget(size_t budget) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = budget;
+  Evict(0);
+}
+
+// 読み込みはmutex_を離してから行うので、複数スレッドが別々のブロックを同時に読める
+ReadCache::BlockPtr ReadCache::Load(size_t key, const Range &parent_range, const Reader &reader) {
+  const size_t start = std::max(key, parent_range.GetStart().to_i());
+  const size_t end = std::min(key + BLOCK_SIZE, parent_range.GetEnd().to_i());
+  size_t generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    BlockPtr found = Find(key, start, end);
+    if (found) {
+      return found;
+    }
+    miss_count_++;
+    generation = generation_;
+  }
+  std::shared_ptr<Block> block = std::make_shared<Block>();
+  block->key = key;
+  block->start = start;
+  block->data.reset(new uint8_t[BLOCK_SIZE]);
+  block->size = start < end ? reader(block->data.get(), Range(start, end, "")) : 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Publish(block, generation);
+}
+
+// mutex_を持った状態で呼ぶ
+ReadCache::BlockPtr ReadCache::Find(size_t key, size_t start, size_t end) {
+  auto it = blocks_.find(key);
+  if (it == blocks_.end()) {
+    return nullptr;
+  }
+  const BlockPtr &block = *it->second;
+  // 別のparent_rangeで読み込まれたブロックは範囲が違うことがあるので読み直す
+  if (block->start <= start && end <= block->start + block->size) {
+    hit_count_++;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return lru_.front();
+  }
+  return nullptr;
+}
+
+// mutex_を持った状態で呼ぶ
+// 読み込み中に別のスレッドが同じブロックを登録していたらそちらを使い、読んだ方は捨てる
+ReadCache::BlockPtr ReadCache::Publish(BlockPtr block, size_t generation) {
+  const size_t end = block->start + block->size;
+  auto it = blocks_.find(block->key);
+  if (it != blocks_.end()) {
+    const BlockPtr &current = *it->second;
+    if (current->start <= block->start && end <= current->start + current->size) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return current;
+    }
+  }
+  if (generation != generation_) {
+    // 読み込み中にInvalidateされたので、この読み込みにだけ使って登録はしない
+    return block;
+  }
+  Erase(block->key);
+  Evict(BLOCK_SIZE);
+  lru_.push_front(block);
+  blocks_[block->key] = lru_.begin();
+  used_ += BLOCK_SIZE;
+  return block;
+}
+
+void ReadCache::Erase(size_t key) {
+  auto it = blocks_.find(key);
+  if (it != blocks_.end()) {
+    used_ -= BLOCK_SIZE;
+    lru_.erase(it->second);
+    blocks_.erase(it);
+  }
+}
+
+// sizeバイトの空きができるまで古いブロックを捨てる
+void ReadCache::Evict(size_t size) {
+  while (!lru_.empty() && used_ + size > budget_) {
+    blocks_.erase(lru_.back()->key);
+    lru_.pop_back();
+    used_ -= BLOCK_SIZE;
+    eviction_count_++;
+  }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "Address.h"
+
+/**
+ * Memory::Readの結果をブロック単位でキャッシュする
+ * 複数のRangeにまたがって使え、budgetを超えたら最後に使われたのが古いブロックから捨てる
+ */
+class ReadCache {
+public:
+  typedef std::function<size_t(uint8_t *dest, const Range &src)> Reader;
+  static const size_t BLOCK_SIZE = 64 * 1024;
+
+  ReadCache() : budget_(64 * 1024 * 1024), used_(0), generation_(0) { ResetCounter(); }
+  ReadCache(ReadCache const &) = delete;
+  ReadCache &operator=(ReadCache const &) = delete;
+
+  // srcを含むブロックをparent_rangeの内側だけreaderで読み込み、キャッシュから返す
+  // 読み込めたバイト数を返す
+  size_t Read(uint8_t *dest, const Range &src, const Range &parent_range, const Reader &reader);
+  void Clear();
+  void Invalidate(const Range &range); // 書き込んだ範囲のブロックを捨てる
+  void SetBudget(size_t budget);
+  size_t GetBudget() const { return budget_; }
+
+  size_t GetHitCount() const { return hit_count_; }
+  size_t GetMissCount() const { return miss_count_; }
+  size_t GetEvictionCount() const { return eviction_count_; }
+
+private:
+  struct Block {
+    size_t key;   // BLOCK_SIZEで切り捨てたアドレス
+    size_t start; // 実際に読み込んだ先頭アドレス
+    size_t size;  // 実際に読み込めたバイト数
+    std::unique_ptr<uint8_t[]> data;
+  };
+  typedef std::shared_ptr<const Block> BlockPtr;
+  BlockPtr Load(size_t key, const Range &parent_range, const Reader &reader);
+  BlockPtr Find(size_t key, size_t start, size_t end);
+  BlockPtr Publish(BlockPtr block, size_t generation);
+  void Erase(size_t key);
+  void Evict(size_t size);
+  void ResetCounter() { hit_count_ = miss_count_ = eviction_count_ = 0; }
+
+  // mutex_はlru_とblocks_の操作の間だけ持ち、readerの呼び出し中は持たない
+  std::mutex mutex_;
+  size_t budget_;
+  size_t used_;
+  // InvalidateとClearのたびに増やし、読み込み中に捨てられたブロックを登録しない
+  size_t generation_;
+  std::list<BlockPtr> lru_; // 先頭ほど最近使われた
+  std::unordered_map<size_t, std::list<BlockPtr>::iterator> blocks_;
+  size_t hit_count_;
+  size_t miss_count_;
+  size_t eviction_count_;
+};
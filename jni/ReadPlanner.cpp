@@ -0,0 +1,95 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include "ReadCache.h"
+#include "ReadPlanner.h"
+#include "Utility.h"
+
+// 見積もりに使うおおよその時間(ns)、x86_64のLinuxで/proc/pid/memとprocess_vm_readvを測ったもの
+// 1回のsyscall、iovecの1要素、1バイトのコピー、キャッシュから1つ取り出すのにかかる時間
+static const double SYSCALL_COST = 700.0;
+static const double IOVEC_COST = 250.0;
+static const double BYTE_COST = 0.2;
+static const double CACHE_COST = 100.0;
+
+static const char *STRATEGY_NAMES[] = {"auto", "point", "page", "full"};
+
+bool ReadPlanner::ParseStrategy(const std::string &name, Strategy &strategy) {
+  for (int i = 0; i < STRATEGY_COUNT; i++) {
+    if (name == STRATEGY_NAMES[i]) {
+      strategy = (Strategy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ReadPlanner::GetStrategyName(Strategy strategy) { return STRATEGY_NAMES[strategy]; }
+
+ReadPlanner::Strategy ReadPlanner::Choose(size_t count, size_t bytes, size_t span, size_t blocks) const {
+  if (forced_ != AUTO) {
+    return forced_ == FULL && span > MAX_FULL_SPAN ? PAGE : forced_;
+  }
+  // POINTは他の区間のものとまとめて読むので、syscallはiovecの数で割った分だけ数える
+  const double point = (double)count / IOVEC_BATCH * SYSCALL_COST + count * IOVEC_COST + bytes * BYTE_COST;
+  const double page = blocks * (SYSCALL_COST + ReadCache::BLOCK_SIZE * BYTE_COST) + count * CACHE_COST;
+  Strategy strategy = point <= page ? POINT : PAGE;
+  if (span <= MAX_FULL_SPAN && SYSCALL_COST + span * BYTE_COST < std::min(point, page)) {
+    strategy = FULL;
+  }
+  return strategy;
+}
+
+void ReadPlanner::Count(Strategy strategy, size_t regions, size_t addresses, size_t syscalls, size_t bytes) {
+  regions_[strategy] += regions;
+  addresses_[strategy] += addresses;
+  syscalls_[strategy] += syscalls;
+  bytes_[strategy] += bytes;
+}
+
+void ReadPlanner::CountScan(size_t chunks, size_t reads, size_t bytes) {
+  scan_chunks_ += chunks;
+  scan_reads_ += reads;
+  scan_bytes_ += bytes;
+}
+
+void ReadPlanner::Reset() {
+  for (int i = 0; i < STRATEGY_COUNT; i++) {
+    regions_[i] = 0;
+    addresses_[i] = 0;
+    syscalls_[i] = 0;
+    bytes_[i] = 0;
+  }
+  scan_chunks_ = 0;
+  scan_reads_ = 0;
+  scan_bytes_ = 0;
+}
+
+void ReadPlanner::Report() const {
+  if (scan_chunks_ > 0) {
+    Utility::DebugLog("Read Plan: scan %zd chunks in %zd reads, %.2lf MB", scan_chunks_.load(), scan_reads_.load(),
+                      (double)scan_bytes_ / 1024.0 / 1024.0);
+  }
+  for (int i = POINT; i < STRATEGY_COUNT; i++) {
+    if (regions_[i] > 0) {
+      Utility::DebugLog("Read Plan: %s %zd regions, %zd addresses in %zd syscalls, %.2lf MB", STRATEGY_NAMES[i],
+                        regions_[i].load(), addresses_[i].load(), syscalls_[i].load(),
+                        (double)bytes_[i] / 1024.0 / 1024.0);
+    }
+  }
+}
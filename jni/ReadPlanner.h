@@ -0,0 +1,68 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <string>
+
+/**
+ * filterで候補アドレスをどう読み込むかを、区間毎に候補の密度から見積もって決める
+ * - POINT: 候補毎にprocess_vm_readvのiovecを1つずつ使う、候補がまばらな場合
+ * - PAGE: 候補が触るReadCacheのブロックだけを読み込む、所々に固まっている場合
+ * - FULL: 最初の候補から最後の候補の終わりまでを1回で読み、そこから切り出す、候補が密な場合
+ * 区間はmapsで隣り合うRangeをまとめたもので、FULL, PAGEはRangeの境界をまたいで読む
+ * 選んだ読み方毎の区間数、syscallの回数と読み込んだバイト数を数えておき、verboseで表示する
+ * lookupでRangeScannerが隣り合うチャンクをまとめて読んだ回数も一緒に表示する
+ */
+class ReadPlanner {
+public:
+  enum Strategy { AUTO, POINT, PAGE, FULL, STRATEGY_COUNT };
+  // FULLで1回に読む上限、スレッド毎にこの大きさまでのバッファを持つ
+  static const size_t MAX_FULL_SPAN = 4 * 1024 * 1024;
+  // process_vm_readvで1回に渡せるiovecの数(IOV_MAX)
+  static const size_t IOVEC_BATCH = 1024;
+
+  ReadPlanner() : forced_(AUTO) { Reset(); }
+  ReadPlanner(ReadPlanner const &) = delete;
+  ReadPlanner &operator=(ReadPlanner const &) = delete;
+
+  // AUTO以外を設定すると、見積もらずに常にその読み方を使う
+  void SetForced(Strategy strategy) { forced_ = strategy; }
+  Strategy GetForced() const { return forced_; }
+  static bool ParseStrategy(const std::string &name, Strategy &strategy);
+  static const char *GetStrategyName(Strategy strategy);
+
+  // count個の候補(合計bytesバイト)が、spanバイトの中のblocks個のブロックに散らばっている時の読み方
+  Strategy Choose(size_t count, size_t bytes, size_t span, size_t blocks) const;
+
+  // 数えた値はReportで表示してResetで0に戻す、複数のスレッドから呼んで良い
+  void Count(Strategy strategy, size_t regions, size_t addresses, size_t syscalls, size_t bytes);
+  void CountScan(size_t chunks, size_t reads, size_t bytes);
+  void Reset();
+  void Report() const;
+
+private:
+  Strategy forced_;
+  std::atomic<size_t> regions_[STRATEGY_COUNT];
+  std::atomic<size_t> addresses_[STRATEGY_COUNT];
+  std::atomic<size_t> syscalls_[STRATEGY_COUNT];
+  std::atomic<size_t> bytes_[STRATEGY_COUNT];
+  std::atomic<size_t> scan_chunks_;
+  std::atomic<size_t> scan_reads_;
+  std::atomic<size_t> scan_bytes_;
+};
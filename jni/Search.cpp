@@ -0,0 +1,390 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <assert.h>
+#include <queue>
+#include <string.h>
+
+#include "Search.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MEMPATCH_SEARCH_X86 1
+#endif
+#if defined(__GNUC__) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MEMPATCH_SEARCH_NEON 1
+#endif
+
+namespace {
+enum class Backend {
+  SCALAR,
+  SSE2,
+  AVX2,
+  NEON,
+};
+
+Backend SelectBackend() {
+#if defined(MEMPATCH_SEARCH_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return Backend::AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return Backend::SSE2;
+  }
+#endif
+#if defined(MEMPATCH_SEARCH_NEON)
+  // arm64ではNEONは必ず使える
+  return Backend::NEON;
+#endif
+  return Backend::SCALAR;
+}
+
+const Backend backend = SelectBackend();
+
+/**
+ * メモリ中でのバイトの現れやすさの目安、小さいほどアンカーに向いている
+ * 0埋めや-1、小さい整数、文字列が多いので、それ以外の値を優先する
+ */
+int ByteCost(uint8_t c) {
+  if (c == 0x00) {
+    return 100;
+  }
+  if (c == 0xff) {
+    return 50;
+  }
+  if (c < 0x10) {
+    return 20;
+  }
+  if (0x20 <= c && c < 0x7f) {
+    return 10;
+  }
+  return 1;
+}
+} // namespace
+
+PatternFinder::PatternFinder(const uint8_t *pattern, size_t size, const uint8_t *mask)
+    : pattern_(pattern, pattern + size) {
+  if (mask != nullptr && std::find_if(mask, mask + size, [](uint8_t m) { return m != 0xff; }) != mask + size) {
+    mask_.assign(mask, mask + size);
+    for (size_t i = 0; i < size; i++) {
+      pattern_[i] &= mask_[i];
+    }
+  }
+  SelectAnchors();
+}
+
+/**
+ * 全てのビットが決まっているバイトの中から、現れにくいものを2つ選ぶ
+ * 同じくらいなら候補が絞れるように、離れた位置の組を選ぶ
+ * 決まっているバイトが無ければ、マスクのビットが多いものを使う
+ */
+void PatternFinder::SelectAnchors() {
+  const size_t l = pattern_.size();
+  first_ = 0;
+  last_ = l == 0 ? 0 : l - 1;
+  if (l <= 2) {
+    return;
+  }
+  auto cost = [this](size_t i) {
+    if (mask_.empty() || mask_[i] == 0xff) {
+      return ByteCost(pattern_[i]);
+    }
+    // 一部だけ決まっているバイトは、決まっているビットが少ないほど候補が多い
+    return 1000 + 100 * (8 - __builtin_popcount(mask_[i]));
+  };
+  std::vector<size_t> order(l);
+  for (size_t i = 0; i < l; i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&cost](size_t a, size_t b) { return cost(a) < cost(b); });
+  const size_t a = order[0];
+  size_t b = order[1];
+  for (size_t k = 2; k < l && cost(order[k]) == cost(order[1]); k++) {
+    // 同じコストなら1つ目から遠い方
+    if ((order[k] > a ? order[k] - a : a - order[k]) > (b > a ? b - a : a - b)) {
+      b = order[k];
+    }
+  }
+  first_ = std::min(a, b);
+  last_ = std::max(a, b);
+}
+
+bool PatternFinder::Match(const uint8_t *src) const {
+  const size_t l = pattern_.size();
+  if (mask_.empty()) {
+    return memcmp(src, pattern_.data(), l) == 0;
+  }
+  for (size_t i = 0; i < l; i++) {
+    if ((src[i] & mask_[i]) != pattern_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char *PatternFinder::GetBackendName() {
+  switch (backend) {
+  case Backend::SSE2:
+    return "sse2";
+  case Backend::AVX2:
+    return "avx2";
+  case Backend::NEON:
+    return "neon";
+  default:
+    return "scalar";
+  }
+}
+
+void PatternFinder::Find(const uint8_t *src, size_t n, std::vector<size_t> &found) const {
+  const size_t l = pattern_.size();
+  if (n < l || l == 0) {
+    return;
+  }
+  assert(src != nullptr);
+  size_t from = 0;
+  switch (backend) {
+#if defined(MEMPATCH_SEARCH_X86)
+  case Backend::SSE2:
+    from = FindSSE2(src, n, found);
+    break;
+  case Backend::AVX2:
+    from = FindAVX2(src, n, found);
+    break;
+#endif
+#if defined(MEMPATCH_SEARCH_NEON)
+  case Backend::NEON:
+    from = FindNEON(src, n, found);
+    break;
+#endif
+  default:
+    break;
+  }
+  // SIMDで処理しきれなかった末尾
+  FindScalar(src, n, from, found);
+}
+
+/**
+ * fromから後ろを1つ目のアンカーをmemchrで探しながら調べる
+ */
+void PatternFinder::FindScalar(const uint8_t *src, size_t n, size_t from, std::vector<size_t> &found) const {
+  const size_t l = pattern_.size();
+  const uint8_t *pattern = pattern_.data();
+  const uint8_t a = pattern[first_];
+  const uint8_t b = pattern[last_];
+  const uint8_t mb = mask_.empty() ? 0xff : mask_[last_];
+  size_t i = from;
+  if (!mask_.empty() && mask_[first_] != 0xff) {
+    // アンカーの一部が??ならmemchrは使えない
+    const uint8_t ma = mask_[first_];
+    for (; i + l <= n; i++) {
+      if ((src[i + first_] & ma) == a && (src[i + last_] & mb) == b && Match(src + i)) {
+        found.push_back(i);
+      }
+    }
+    return;
+  }
+  while (i + l <= n) {
+    const uint8_t *p = (const uint8_t *)memchr(src + i + first_, a, n - l + 1 - i);
+    if (p == nullptr) {
+      break;
+    }
+    i = p - src - first_;
+    if ((src[i + last_] & mb) == b && Match(src + i)) {
+      found.push_back(i);
+    }
+    i++;
+  }
+}
+
+#if defined(MEMPATCH_SEARCH_X86)
+/**
+ * 2つのアンカーの一致をそれぞれ16バイトずつ比較し、両方一致した位置だけを確認する
+ * アンカーのマスクを掛けてから比較するので、??を含むバイトもアンカーにできる
+ * 戻り値はまだ調べていない位置
+ */
+__attribute__((target("sse2"))) size_t PatternFinder::FindSSE2(const uint8_t *src, size_t n,
+                                                                std::vector<size_t> &found) const {
+  const size_t l = pattern_.size();
+  const uint8_t *pattern = pattern_.data();
+  const __m128i a = _mm_set1_epi8((char)pattern[first_]);
+  const __m128i b = _mm_set1_epi8((char)pattern[last_]);
+  const __m128i ma = _mm_set1_epi8((char)(mask_.empty() ? 0xff : mask_[first_]));
+  const __m128i mb = _mm_set1_epi8((char)(mask_.empty() ? 0xff : mask_[last_]));
+  size_t i = 0;
+  for (; i + l + 15 <= n; i += 16) {
+    const __m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i + first_)), ma);
+    const __m128i y = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i + last_)), mb);
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, a), _mm_cmpeq_epi8(y, b)));
+    while (mask != 0) {
+      size_t j = i + __builtin_ctz(mask);
+      if (Match(src + j)) {
+        found.push_back(j);
+      }
+      mask &= mask - 1;
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t PatternFinder::FindAVX2(const uint8_t *src, size_t n,
+                                                                std::vector<size_t> &found) const {
+  const size_t l = pattern_.size();
+  const uint8_t *pattern = pattern_.data();
+  const __m256i a = _mm256_set1_epi8((char)pattern[first_]);
+  const __m256i b = _mm256_set1_epi8((char)pattern[last_]);
+  const __m256i ma = _mm256_set1_epi8((char)(mask_.empty() ? 0xff : mask_[first_]));
+  const __m256i mb = _mm256_set1_epi8((char)(mask_.empty() ? 0xff : mask_[last_]));
+  size_t i = 0;
+  for (; i + l + 31 <= n; i += 32) {
+    const __m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + i + first_)), ma);
+    const __m256i y = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + i + last_)), mb);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, a), _mm256_cmpeq_epi8(y, b)));
+    while (mask != 0) {
+      size_t j = i + __builtin_ctz(mask);
+      if (Match(src + j)) {
+        found.push_back(j);
+      }
+      mask &= mask - 1;
+    }
+  }
+  return i;
+}
+#endif
+
+#if defined(MEMPATCH_SEARCH_NEON)
+size_t PatternFinder::FindNEON(const uint8_t *src, size_t n, std::vector<size_t> &found) const {
+  const size_t l = pattern_.size();
+  const uint8_t *pattern = pattern_.data();
+  const uint8x16_t a = vdupq_n_u8(pattern[first_]);
+  const uint8x16_t b = vdupq_n_u8(pattern[last_]);
+  const uint8x16_t ma = vdupq_n_u8(mask_.empty() ? 0xff : mask_[first_]);
+  const uint8x16_t mb = vdupq_n_u8(mask_.empty() ? 0xff : mask_[last_]);
+  size_t i = 0;
+  for (; i + l + 15 <= n; i += 16) {
+    const uint8x16_t x = vandq_u8(vld1q_u8(src + i + first_), ma);
+    const uint8x16_t y = vandq_u8(vld1q_u8(src + i + last_), mb);
+    const uint8x16_t eq = vandq_u8(vceqq_u8(x, a), vceqq_u8(y, b));
+    // NEONにはmovemaskが無いので、1バイトを4ビットに縮めて64ビットのマスクにする
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    mask &= 0x8888888888888888ULL;
+    while (mask != 0) {
+      size_t j = i + __builtin_ctzll(mask) / 4;
+      if (Match(src + j)) {
+        found.push_back(j);
+      }
+      mask &= mask - 1;
+    }
+  }
+  return i;
+}
+#endif
+
+// これ以下のパターン数ならPatternFinderを使う
+static const size_t MAX_SIMD_PATTERNS = 16;
+
+MultiPatternFinder::MultiPatternFinder(const std::vector<std::vector<uint8_t>> &patterns) : max_size_(0) {
+  if (patterns.size() <= MAX_SIMD_PATTERNS) {
+    for (auto it = patterns.begin(); it != patterns.end(); it++) {
+      finders_.emplace_back(it->data(), it->size());
+      sizes_.push_back(it->size());
+      max_size_ = std::max(max_size_, it->size());
+    }
+    return;
+  }
+  // トライを作る、0が根で、遷移が無いところは0にしておく
+  std::vector<std::vector<uint32_t>> outputs(1);
+  transitions_.assign(256, 0);
+  for (size_t i = 0; i < patterns.size(); i++) {
+    sizes_.push_back(patterns[i].size());
+    max_size_ = std::max(max_size_, patterns[i].size());
+    if (patterns[i].empty()) {
+      continue;
+    }
+    uint32_t state = 0;
+    for (auto it = patterns[i].begin(); it != patterns[i].end(); it++) {
+      uint32_t &next = transitions_[state * 256 + *it];
+      if (next == 0) {
+        next = outputs.size();
+        outputs.emplace_back();
+        transitions_.resize(transitions_.size() + 256, 0);
+      }
+      state = transitions_[state * 256 + *it];
+    }
+    outputs[state].push_back(i);
+  }
+
+  // 幅優先で失敗遷移を求めて、遷移表を完全なDFAにする
+  std::vector<uint32_t> fail(outputs.size(), 0);
+  std::queue<uint32_t> queue;
+  for (size_t c = 0; c < 256; c++) {
+    if (transitions_[c] != 0) {
+      queue.push(transitions_[c]);
+    }
+  }
+  while (!queue.empty()) {
+    uint32_t state = queue.front();
+    queue.pop();
+    // 失敗遷移先で終わるパターンは、ここでも終わっている
+    const std::vector<uint32_t> &inherited = outputs[fail[state]];
+    outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+    for (size_t c = 0; c < 256; c++) {
+      uint32_t &next = transitions_[state * 256 + c];
+      if (next != 0) {
+        fail[next] = transitions_[fail[state] * 256 + c];
+        queue.push(next);
+      } else {
+        next = transitions_[fail[state] * 256 + c];
+      }
+    }
+  }
+
+  output_start_.push_back(0);
+  for (auto it = outputs.begin(); it != outputs.end(); it++) {
+    outputs_.insert(outputs_.end(), it->begin(), it->end());
+    output_start_.push_back(outputs_.size());
+  }
+}
+
+void MultiPatternFinder::Find(const uint8_t *src, size_t n, std::vector<Match> &found) const {
+  const size_t first = found.size();
+  if (!finders_.empty()) {
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < finders_.size(); i++) {
+      indexes.clear();
+      finders_[i].Find(src, n, indexes);
+      for (auto it = indexes.begin(); it != indexes.end(); it++) {
+        found.push_back(Match{*it, i});
+      }
+    }
+    std::sort(found.begin() + first, found.end());
+    return;
+  }
+  const uint32_t *transitions = transitions_.data();
+  const uint32_t *output_start = output_start_.data();
+  uint32_t state = 0;
+  for (size_t i = 0; i < n; i++) {
+    state = transitions[state * 256 + src[i]];
+    for (uint32_t k = output_start[state]; k < output_start[state + 1]; k++) {
+      const uint32_t pattern = outputs_[k];
+      found.push_back(Match{i + 1 - sizes_[pattern], pattern});
+    }
+  }
+  // 終わる位置の順に見つかるので、始まる位置の順に並べ直す
+  std::sort(found.begin() + first, found.end());
+}
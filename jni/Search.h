@@ -0,0 +1,91 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * バイト列の一致検索
+ * パターンの中の2バイト(アンカー)が一致する位置をSIMDで16~32バイトずつまとめて探し、
+ * 候補だけをmemcmpで確認する
+ * アンカーにはメモリ中に現れにくいバイト(0x00や0xff、小さい値以外)を選ぶ
+ * マスクを渡すと、マスクが0のビットは比較しない(aobの??)
+ * x86-64ではSSE2とAVX2、arm64ではNEONを使い、使えない環境ではmemchrで1つ目のアンカーを探す
+ */
+class PatternFinder {
+public:
+  PatternFinder() = delete;
+  // maskがnullptrなら完全一致
+  PatternFinder(const uint8_t *pattern, size_t size, const uint8_t *mask = nullptr);
+
+  // srcのnバイトの中でパターンが始まる位置を昇順にfoundに追加する
+  void Find(const uint8_t *src, size_t n, std::vector<size_t> &found) const;
+  size_t Size() const { return pattern_.size(); }
+
+  static const char *GetBackendName(); // 実行時に選ばれた実装の名前
+
+private:
+  std::vector<uint8_t> pattern_; // マスクが0のビットは0にしておく
+  std::vector<uint8_t> mask_;    // 完全一致なら空
+  size_t first_;                 // アンカーの位置
+  size_t last_;
+
+  void SelectAnchors();
+  bool Match(const uint8_t *src) const;
+  void FindScalar(const uint8_t *src, size_t n, size_t from, std::vector<size_t> &found) const;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  size_t FindSSE2(const uint8_t *src, size_t n, std::vector<size_t> &found) const;
+  size_t FindAVX2(const uint8_t *src, size_t n, std::vector<size_t> &found) const;
+#endif
+#if defined(__GNUC__) && defined(__aarch64__)
+  size_t FindNEON(const uint8_t *src, size_t n, std::vector<size_t> &found) const;
+#endif
+};
+
+/**
+ * 複数のバイト列を1回の走査で探す
+ * パターンが少ない場合は、読み込んだバッファに対してPatternFinderをパターンの数だけ走らせる方が速い
+ * 多い場合はAho-Corasickで、全てのパターンから256分岐の遷移表を作っておき、1バイトごとに表を引くだけで進める
+ */
+class MultiPatternFinder {
+public:
+  // 見つかった位置と、一致したパターンの番号
+  struct Match {
+    size_t index;
+    size_t pattern;
+    bool operator<(const Match &rhs) const {
+      return index < rhs.index || (index == rhs.index && pattern < rhs.pattern);
+    }
+  };
+
+  MultiPatternFinder() = delete;
+  explicit MultiPatternFinder(const std::vector<std::vector<uint8_t>> &patterns);
+
+  // srcのnバイトの中でいずれかのパターンが始まる位置を、位置とパターンの番号の昇順にfoundに追加する
+  void Find(const uint8_t *src, size_t n, std::vector<Match> &found) const;
+  size_t GetMaxSize() const { return max_size_; }
+
+private:
+  std::vector<size_t> sizes_;          // パターン毎の長さ
+  std::vector<uint32_t> transitions_;  // 状態 * 256 + バイト -> 次の状態
+  std::vector<uint32_t> output_start_; // 状態毎に、そこで終わるパターンがoutputs_のどこから並んでいるか
+  std::vector<uint32_t> outputs_;
+  size_t max_size_;
+  std::vector<PatternFinder> finders_; // パターンが少ない場合だけ使う
+};
@@ -14,6 +14,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+
 #include "Snapshot.h"
 
-std::unique_ptr<uint8_t[]> SnappedRange::data() const { return _parent->pull(_fileoff, _range.Size()); }
+const uint8_t *SnappedRange::page(size_t n, uint8_t *scratch) const {
+  const size_t size = std::min(Snapshot::PAGE, _range.Size() - n * Snapshot::PAGE);
+  return _parent->page(_fileoff, n, size, scratch);
+}
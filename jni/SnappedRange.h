@@ -16,7 +16,6 @@
  */
 #pragma once
 
-#include <memory>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -26,13 +25,15 @@ class Snapshot;
 
 class SnappedRange {
 public:
-  SnappedRange(const Snapshot *snapshot, const Range &range, off_t fileoff)
+  SnappedRange(const Snapshot *snapshot, const Range &range, uint64_t fileoff)
       : _parent(snapshot), _range(range), _fileoff(fileoff) {}
-  Range range() const { return _range; }
-  std::unique_ptr<uint8_t[]> data() const;
+  const Range &range() const { return _range; }
+  // n番目のページ、Snapshotをmmapした領域かscratchを指す
+  // scratchにはSnapshot::PAGEバイト必要で、返したものは次にscratchを使うかSnapshotが消えるまで使える
+  const uint8_t *page(size_t n, uint8_t *scratch) const;
 
 private:
   const Snapshot *_parent;
   Range _range;
-  off_t _fileoff;
+  uint64_t _fileoff;
 };
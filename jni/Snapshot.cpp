@@ -0,0 +1,360 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef NOMINMAX
+#define NOMINMAX // std::minを使うので
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Snapshot.h"
+#include "Utility.h"
+#include "lz4/Lz4Block.h"
+
+const char Snapshot::MAGIC[8] = {'M', 'P', 'S', 'N', 'A', 'P', '2', '\0'};
+const size_t Snapshot::PAGE;
+
+// ページ表と中身の始まりはこの倍数に揃える
+static const uint64_t SNAPSHOT_ALIGN = 64 * 1024;
+// 書いたページの中身の位置はこの倍数に揃え、そのまま書いたページをmmapした領域から4バイトずつ読めるようにする
+static const uint64_t DATA_ALIGN = 8;
+// 全て0のページはこれを返す
+static const uint8_t ZERO_PAGE[Snapshot::PAGE] = {};
+
+static uint64_t AlignUp(uint64_t n, uint64_t align) { return (n + align - 1) & ~(align - 1); }
+
+static bool IsZero(const uint8_t *data, size_t size) {
+  uint64_t bits = 0;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t v;
+    memcpy(&v, data + i, sizeof(v));
+    bits |= v;
+  }
+  for (; i < size; i++) {
+    bits |= data[i];
+  }
+  return bits == 0;
+}
+
+// 重複を探すためのページ内容のハッシュ、一致したら中身も比べるので衝突しても誤らない
+static uint64_t HashPage(const uint8_t *data, size_t size) {
+  uint64_t h = 14695981039346656037ull ^ size;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t v;
+    memcpy(&v, data + i, sizeof(v));
+    h = (h ^ v) * 1099511628211ull;
+    h ^= h >> 29;
+  }
+  for (; i < size; i++) {
+    h = (h ^ data[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+bool Snapshot::open(const RangeSet &ranges) {
+  clear();
+#if defined(_WIN32) || defined(_WIN64)
+  _file = CreateFileA(_filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (_file == INVALID_HANDLE_VALUE) {
+    _file = nullptr;
+    Utility::DebugLog("can't create %s (error %lu)", _filename.c_str(), GetLastError());
+    return false;
+  }
+#else
+  _fd = ::open(_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (_fd < 0) {
+    Utility::DebugLog("can't create %s: %s", _filename.c_str(), strerror(errno));
+    return false;
+  }
+#endif
+  uint64_t offset = AlignUp(sizeof(MAGIC) + sizeof(uint64_t) + ranges.size() * sizeof(IndexEntry), SNAPSHOT_ALIGN);
+  for (auto it = ranges.begin(); it != ranges.end(); it++) {
+    const size_t pages = (it->Size() + PAGE - 1) / PAGE;
+    _index.push_back(IndexEntry{it->GetStart().to_i(), it->GetEnd().to_i(), offset});
+    _saved.push_back(SnappedRange(this, *it, offset));
+    _tables.emplace_back(pages, 0);
+    _total += it->Size();
+    offset += pages * sizeof(uint64_t);
+  }
+  _data_start = AlignUp(offset, SNAPSHOT_ALIGN);
+  _data_end = _data_start;
+  return true;
+}
+
+bool Snapshot::write(size_t i, size_t offset, const void *data, size_t size) {
+  assert(offset % PAGE == 0);
+  const uint8_t *src = (const uint8_t *)data;
+  const size_t pages = (size + PAGE - 1) / PAGE;
+  // 書くページをstagedに並べて、最後にまとめて1回で書く
+  // 場所が決まるまでは、ページ表の要素の位置はstagedの中の位置にしておく
+  std::vector<uint8_t> staged;
+  std::vector<uint64_t> entries(pages, 0);
+  std::vector<bool> in_staged(pages, false);
+  std::unordered_map<uint64_t, size_t> local; // このwriteで書くページのハッシュからページの番号
+  std::vector<uint8_t> compressed(PAGE);
+  for (size_t j = 0; j < pages; j++) {
+    const uint8_t *p = src + j * PAGE;
+    const size_t n = std::min(PAGE, size - j * PAGE);
+    if (IsZero(p, n)) {
+      continue;
+    }
+    const uint64_t hash = HashPage(p, n);
+    auto found = local.find(hash);
+    if (found != local.end() && std::min(PAGE, size - found->second * PAGE) == n &&
+        memcmp(src + found->second * PAGE, p, n) == 0) {
+      entries[j] = entries[found->second];
+      in_staged[j] = true;
+      _duplicate_pages++;
+      continue;
+    }
+    if (findStored(hash, p, n, entries[j])) {
+      _duplicate_pages++;
+      continue;
+    }
+    const size_t at = staged.size();
+    size_t stored = Lz4Block::Compress(p, n, compressed.data(), n - 1);
+    if (stored == 0) {
+      staged.insert(staged.end(), p, p + n);
+      stored = n;
+      _raw_pages++;
+    } else {
+      staged.insert(staged.end(), compressed.begin(), compressed.begin() + stored);
+      _compressed_pages++;
+    }
+    staged.resize(AlignUp(staged.size(), DATA_ALIGN), 0);
+    entries[j] = MakeEntry(at, stored);
+    in_staged[j] = true;
+    local.emplace(hash, j);
+  }
+
+  const uint64_t base = _data_end.fetch_add(staged.size());
+  if (!staged.empty() && !writeAt(base, staged.data(), staged.size())) {
+    return false;
+  }
+  std::vector<uint64_t> &table = _tables[i];
+  for (size_t j = 0; j < pages; j++) {
+    if (in_staged[j]) {
+      entries[j] = MakeEntry(base + EntryOffset(entries[j]), EntryStored(entries[j]));
+    }
+    table[offset / PAGE + j] = entries[j];
+  }
+  // 書き終わってから登録するので、他のスレッドはfindStoredで読み直して比べられる
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (auto it = local.begin(); it != local.end(); it++) {
+    _stored.emplace(it->first, entries[it->second]);
+  }
+  return true;
+}
+
+bool Snapshot::findStored(uint64_t hash, const uint8_t *data, size_t size, uint64_t &entry) {
+  uint64_t candidate;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _stored.find(hash);
+    if (it == _stored.end()) {
+      return false;
+    }
+    candidate = it->second;
+  }
+  const size_t stored = EntryStored(candidate);
+  uint8_t buffer[PAGE];
+  uint8_t decoded[PAGE];
+  if (stored > PAGE || !readAt(EntryOffset(candidate), buffer, stored)) {
+    return false;
+  }
+  const uint8_t *p = buffer;
+  if (stored != size) {
+    if (!Lz4Block::Decompress(buffer, stored, decoded, size)) {
+      return false;
+    }
+    p = decoded;
+  }
+  if (memcmp(p, data, size) != 0) {
+    return false;
+  }
+  entry = candidate;
+  return true;
+}
+
+bool Snapshot::finish() {
+  const uint64_t count = _index.size();
+  if (!writeAt(0, MAGIC, sizeof(MAGIC)) || !writeAt(sizeof(MAGIC), &count, sizeof(count)) ||
+      !writeAt(sizeof(MAGIC) + sizeof(count), _index.data(), _index.size() * sizeof(IndexEntry))) {
+    return false;
+  }
+  for (size_t i = 0; i < _tables.size(); i++) {
+    if (!writeAt(_index[i].table_offset, _tables[i].data(), _tables[i].size() * sizeof(uint64_t))) {
+      return false;
+    }
+  }
+  // ページ表はファイルから読むので、メモリ上のものと重複の表は捨てる
+  std::vector<std::vector<uint64_t>>().swap(_tables);
+  std::unordered_map<uint64_t, uint64_t>().swap(_stored);
+  _map_size = _data_end;
+#if defined(_WIN32) || defined(_WIN64)
+  _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (_mapping == nullptr) {
+    Utility::DebugLog("can't map %s (error %lu)", _filename.c_str(), GetLastError());
+    return false;
+  }
+  _map = (uint8_t *)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (_map == nullptr) {
+    Utility::DebugLog("can't map %s (error %lu)", _filename.c_str(), GetLastError());
+    return false;
+  }
+#else
+  void *map = mmap(nullptr, _map_size, PROT_READ, MAP_SHARED, _fd, 0);
+  if (map == MAP_FAILED) {
+    Utility::DebugLog("can't mmap %s: %s", _filename.c_str(), strerror(errno));
+    return false;
+  }
+  _map = (uint8_t *)map;
+#endif
+  return true;
+}
+
+const uint8_t *Snapshot::page(uint64_t table_offset, size_t n, size_t size, uint8_t *scratch) const {
+  uint64_t entry;
+  memcpy(&entry, _map + table_offset + n * sizeof(uint64_t), sizeof(entry));
+  const size_t stored = EntryStored(entry);
+  if (stored == 0) {
+    return ZERO_PAGE;
+  }
+  if (stored == size) {
+    return _map + EntryOffset(entry);
+  }
+  if (!Lz4Block::Decompress(_map + EntryOffset(entry), stored, scratch, size)) {
+    Utility::DebugLog("snapshot is broken at %llx", (unsigned long long)EntryOffset(entry));
+    memset(scratch, 0, size);
+  }
+  return scratch;
+}
+
+void Snapshot::report() const {
+  const size_t pages = (size_t)((_total + PAGE - 1) / PAGE);
+  const size_t zero = pages - _duplicate_pages - _compressed_pages - _raw_pages;
+  Utility::DebugLog("Snapshot: %.2lf MB stored in %.2lf MB (zero %zd, duplicate %zd, compressed %zd, raw %zd pages)",
+                    (double)_total / 1024.0 / 1024.0, (double)(_data_end - _data_start) / 1024.0 / 1024.0, zero,
+                    _duplicate_pages.load(), _compressed_pages.load(), _raw_pages.load());
+}
+
+void Snapshot::clear() {
+#if defined(_WIN32) || defined(_WIN64)
+  if (_map != nullptr) {
+    UnmapViewOfFile(_map);
+  }
+  if (_mapping != nullptr) {
+    CloseHandle(_mapping);
+    _mapping = nullptr;
+  }
+  if (_file != nullptr) {
+    CloseHandle(_file);
+    _file = nullptr;
+  }
+#else
+  if (_map != nullptr) {
+    munmap(_map, _map_size);
+  }
+  if (_fd >= 0) {
+    close(_fd);
+    _fd = -1;
+  }
+#endif
+  _map = nullptr;
+  _map_size = 0;
+  _saved.clear();
+  _index.clear();
+  _tables.clear();
+  _stored.clear();
+  _data_start = 0;
+  _data_end = 0;
+  _duplicate_pages = 0;
+  _compressed_pages = 0;
+  _raw_pages = 0;
+  _total = 0;
+  ::remove(_filename.c_str());
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+bool Snapshot::writeAt(uint64_t offset, const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t done = 0; done < size;) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD)(offset + done);
+    overlapped.OffsetHigh = (DWORD)((offset + done) >> 32);
+    DWORD n = 0;
+    DWORD request = (DWORD)std::min(size - done, (size_t)1024 * 1024 * 1024);
+    if (!WriteFile(_file, p + done, request, &n, &overlapped) || n == 0) {
+      Utility::DebugLog("can't write snapshot (error %lu)", GetLastError());
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool Snapshot::readAt(uint64_t offset, void *data, size_t size) const {
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = (DWORD)offset;
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  DWORD n = 0;
+  return ReadFile(_file, data, (DWORD)size, &n, &overlapped) && n == size;
+}
+#else
+bool Snapshot::writeAt(uint64_t offset, const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t done = 0; done < size;) {
+    ssize_t n = pwrite(_fd, p + done, size - done, (off_t)(offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      Utility::DebugLog("can't write snapshot: %s", strerror(errno));
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool Snapshot::readAt(uint64_t offset, void *data, size_t size) const {
+  uint8_t *p = (uint8_t *)data;
+  for (size_t done = 0; done < size;) {
+    ssize_t n = pread(_fd, p + done, size - done, (off_t)(offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+#endif
@@ -16,52 +16,94 @@
  */
 #pragma once
 
-#include <memory>
-#include <stdio.h>
-#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Address.h"
 #include "Config.h"
 #include "SnappedRange.h"
 
+/**
+ * diff startで読み込んだメモリの内容を置いておくファイル
+ * 先頭にRange毎の開始・終了アドレスとページ表の位置を並べた索引を置き、その後ろにRange毎のページ表、中身を並べる
+ * 中身はPAGEバイト毎に、全て0のページは書かずに表で0と示し、既に書いたページと同じ内容ならその場所を指すだけにして、
+ * 残りはLZ4のブロック形式で圧縮して書く(圧縮しても小さくならなければそのまま書く)
+ * openで索引の大きさを決めてから、各Rangeの中身をwriteで好きな順に(複数のスレッドからでも)書き込み、
+ * finishで索引とページ表を書いてから全体を読み込み専用でmmapする
+ * SnappedRange::pageは0のページとそのまま書いたページはmmapした領域を直接指し、圧縮したページは展開して返す
+ */
 class Snapshot {
 public:
-  typedef std::vector<SnappedRange>::iterator iterator;
+  typedef std::vector<SnappedRange>::const_iterator iterator;
+  // 0や重複を調べて圧縮する単位
+  static const size_t PAGE = 4096;
 
 public:
   Snapshot() {}
   Snapshot(const char *filename) : _filename(filename) {}
-  ~Snapshot() { ::remove(_filename.c_str()); }
+  Snapshot(Snapshot const &) = delete;
+  Snapshot &operator=(Snapshot const &) = delete;
+  ~Snapshot() { clear(); }
 
-  void clear() { ::remove(_filename.c_str()); }
+  void clear();
 
-  iterator begin() { return _saved.begin(); }
-  iterator end() { return _saved.end(); }
+  iterator begin() const { return _saved.begin(); }
+  iterator end() const { return _saved.end(); }
+  size_t size() const { return _saved.size(); }
 
-  void push_back(const Range &range, const void *data) {
-    size_t size = range.Size();
-    off_t offset = push(data, size);
-    _saved.push_back(SnappedRange(this, range, offset));
-  }
-  off_t push(const void *data, size_t size) {
-    struct stat stbuf;
-    off_t offset = stat(_filename.c_str(), &stbuf) != -1 ? stbuf.st_size : 0;
-    FILE *file = fopen(_filename.c_str(), "ab+");
-    ::fwrite((const char *)data, size, 1, file);
-    fclose(file);
-    return offset;
-  }
-  std::unique_ptr<uint8_t[]> pull(off_t offset, size_t size) const {
-    std::unique_ptr<uint8_t[]> buf = std::make_unique<uint8_t[]>(size);
-    FILE *file = fopen(_filename.c_str(), "rb");
-    fseek(file, offset, SEEK_SET);
-    ::fread(buf.get(), size, 1, file);
-    fclose(file);
-    return buf;
-  }
+  // rangesの索引とページ表の場所を空けたファイルを作る、書き込まなかったページは0として読める
+  bool open(const RangeSet &ranges);
+  // i番目のRangeのoffsetバイト目(PAGEの倍数)からsizeバイトを書き込む、重ならなければ複数のスレッドから呼んで良い
+  bool write(size_t i, size_t offset, const void *data, size_t size);
+  // 索引とページ表を書いてmmapする、これ以降はSnappedRange::pageで読める
+  bool finish();
+  // table_offsetにあるページ表のn番目のページ、sizeはそのページの大きさ
+  // 圧縮されていればscratchに展開してscratchを返す
+  const uint8_t *page(uint64_t table_offset, size_t n, size_t size, uint8_t *scratch) const;
+  // 元の大きさと書き込んだ大きさ、ページの種類毎の数を表示する
+  void report() const;
 
 private:
+  // 索引の1要素、ファイルにはこのまま書く
+  struct IndexEntry {
+    uint64_t start;
+    uint64_t end;
+    uint64_t table_offset;
+  };
+  // ページ表の1要素は、中身の位置を上位48ビット、書いた大きさを下位16ビットに入れる
+  // 大きさが0なら全て0のページ、ページの大きさと同じなら圧縮せずに書いたページ
+  static uint64_t MakeEntry(uint64_t offset, size_t stored) { return (offset << 16) | stored; }
+  static uint64_t EntryOffset(uint64_t entry) { return entry >> 16; }
+  static size_t EntryStored(uint64_t entry) { return (size_t)(entry & 0xffff); }
+  static const char MAGIC[8];
+
+  // 同じ内容のページが既に書かれていればtrueを返し、entryにその場所を入れる
+  bool findStored(uint64_t hash, const uint8_t *data, size_t size, uint64_t &entry);
+  bool writeAt(uint64_t offset, const void *data, size_t size);
+  bool readAt(uint64_t offset, void *data, size_t size) const;
+
   std::string _filename = std::string(STORAGE_PATH) + "/mempatch_memory-snapshot";
   std::vector<SnappedRange> _saved;
+  std::vector<IndexEntry> _index;
+  std::vector<std::vector<uint64_t>> _tables; // Range毎のページ表
+  uint64_t _data_start = 0;
+  std::atomic<uint64_t> _data_end{0}; // 中身を書く次の位置、書く前に大きさの分だけ進めて場所を取る
+  std::mutex _mutex;
+  std::unordered_map<uint64_t, uint64_t> _stored; // 書いたページの内容のハッシュからページ表の要素
+  std::atomic<size_t> _duplicate_pages{0};
+  std::atomic<size_t> _compressed_pages{0};
+  std::atomic<size_t> _raw_pages{0};
+  uint64_t _total = 0; // 元の大きさ
+  uint8_t *_map = nullptr;
+  uint64_t _map_size = 0;
+#if defined(_WIN32) || defined(_WIN64)
+  void *_file = nullptr;
+  void *_mapping = nullptr;
+#else
+  int _fd = -1;
+#endif
 };
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Config.h"
+#include "SpillFile.h"
+#include "Utility.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+bool SpillFile::Append(const void *data, size_t size) {
+  Utility::DebugLog("spilling to a file is not supported on this platform");
+  return false;
+}
+
+void SpillFile::Close() { ; }
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool SpillFile::Append(const void *data, size_t size) {
+  if (fd_ < 0) {
+    std::string path = std::string(STORAGE_PATH) + "/mempatch_candidates-XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if (fd_ < 0) {
+      Utility::DebugLog("can't create %s: %s", path.c_str(), strerror(errno));
+      return false;
+    }
+    // 開いている間だけ使うので、名前はすぐに消しておく
+    unlink(path.c_str());
+  }
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t done = 0; done < size;) {
+    ssize_t n = pwrite(fd_, p + done, size - done, size_ + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      Utility::DebugLog("can't write spill file: %s", strerror(errno));
+      return false;
+    }
+    done += n;
+  }
+  // 失敗しても今までの内容は読めるように、新しくmmapできてから古い方を外す
+  void *map = mmap(nullptr, size_ + size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED) {
+    Utility::DebugLog("can't mmap spill file: %s", strerror(errno));
+    return false;
+  }
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+  }
+  map_ = (uint8_t *)map;
+  size_ += size;
+  return true;
+}
+
+void SpillFile::Close() {
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+    map_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+}
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <assert.h>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * STORAGE_PATHに作る追記専用の一時ファイル
+ * 作った直後に削除するので、閉じれば(プロセスが落ちても)ディスクから消える
+ * 書き込んだ内容は全体をmmapして読む
+ */
+class SpillFile {
+public:
+  SpillFile() : fd_(-1), map_(nullptr), size_(0) { ; }
+  SpillFile(SpillFile const &) = delete;
+  SpillFile &operator=(SpillFile const &) = delete;
+  ~SpillFile() { Close(); }
+
+  // 末尾に追記して、追記後の全体をmmapし直す
+  bool Append(const void *data, size_t size);
+  const uint8_t *Data() const { return map_; }
+  size_t Size() const { return size_; }
+  void Close();
+
+private:
+  int fd_;
+  uint8_t *map_;
+  size_t size_;
+};
+
+/**
+ * 先頭から順にSpillFileに書き出せる配列
+ * [0, GetSpilledSize()) はファイルをmmapしたもの、それ以降はメモリ上にあり、書き換えられるのはメモリ上の部分だけ
+ */
+template <class T> class SpillArray {
+public:
+  SpillArray() : spilled_(0), spilled_data_(nullptr) { ; }
+  // コピーは全てメモリ上に読み込む
+  SpillArray(const SpillArray &rhs) : spilled_(0), spilled_data_(nullptr) { Append(rhs); }
+  SpillArray &operator=(const SpillArray &rhs) {
+    if (this != &rhs) {
+      clear();
+      Append(rhs);
+    }
+    return *this;
+  }
+  SpillArray(SpillArray &&rhs)
+      : file_(std::move(rhs.file_)), spilled_(rhs.spilled_), spilled_data_(rhs.spilled_data_),
+        memory_(std::move(rhs.memory_)) {
+    rhs.clear();
+  }
+  SpillArray &operator=(SpillArray &&rhs) {
+    if (this != &rhs) {
+      file_ = std::move(rhs.file_);
+      spilled_ = rhs.spilled_;
+      spilled_data_ = rhs.spilled_data_;
+      memory_ = std::move(rhs.memory_);
+      rhs.clear();
+    }
+    return *this;
+  }
+
+  size_t size() const { return spilled_ + memory_.size(); }
+  bool empty() const { return size() == 0; }
+  const T &operator[](size_t i) const { return i < spilled_ ? spilled_data_[i] : memory_[i - spilled_]; }
+  T &Mutable(size_t i) {
+    assert(i >= spilled_);
+    return memory_[i - spilled_];
+  }
+  void push_back(const T &v) { memory_.push_back(v); }
+  void Append(const T *data, size_t n) { memory_.insert(memory_.end(), data, data + n); }
+  void Append(const SpillArray &rhs) {
+    Append(rhs.spilled_data_, rhs.spilled_);
+    memory_.insert(memory_.end(), rhs.memory_.begin(), rhs.memory_.end());
+  }
+  void resize(size_t n, const T &v = T()) {
+    assert(n >= spilled_);
+    memory_.resize(n - spilled_, v);
+  }
+  void clear() {
+    memory_.clear();
+    file_.reset();
+    spilled_ = 0;
+    spilled_data_ = nullptr;
+  }
+  void shrink_to_fit() { memory_.shrink_to_fit(); }
+
+  size_t GetMemorySize() const { return memory_.size() * sizeof(T); }
+  size_t GetSpilledSize() const { return spilled_; }
+
+  // [GetSpilledSize(), upto) をファイルに書き出してメモリから消す
+  bool Spill(size_t upto) {
+    if (upto <= spilled_) {
+      return true;
+    }
+    if (!file_) {
+      file_ = std::make_unique<SpillFile>();
+    }
+    const size_t n = upto - spilled_;
+    if (!file_->Append(memory_.data(), n * sizeof(T))) {
+      return false;
+    }
+    // 残りだけを新しい領域に移して、大きくなった領域を解放する
+    std::vector<T>(memory_.begin() + n, memory_.end()).swap(memory_);
+    spilled_ = upto;
+    spilled_data_ = (const T *)file_->Data();
+    return true;
+  }
+
+private:
+  std::unique_ptr<SpillFile> file_;
+  size_t spilled_;
+  const T *spilled_data_;
+  std::vector<T> memory_;
+};
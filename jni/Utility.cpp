@@ -15,8 +15,8 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
-#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,85 +103,43 @@ std::string HexDump(size_t address, const char *comment, const uint8_t *data, si
   return ret;
 }
 
-std::vector<size_t> StrstrByRollingHash(const uint8_t *src, const uint8_t *str, size_t n, size_t l) {
-  const uint32_t BASE = 1e+9 + 7;
-  assert(src != nullptr);
-  assert(str != nullptr);
-  if (n < l || n == 0 || l == 0) {
-    return std::vector<size_t>();
+bool StringToSize(const std::string &str, size_t &size) {
+  const char *p = str.c_str();
+  while (isspace(*p)) {
+    p++;
   }
-
-  // strのローリングハッシュ作成
-  uint32_t rolling_hash = 0;
-  for (size_t i = 0; i < l; i++) {
-    uint32_t v = str[i];
-    rolling_hash = rolling_hash * BASE + v;
-  }
-
-  // ローリングハッシュのキャンセル用の値を作成
-  uint32_t BASE_len = 1;
-  for (size_t i = 0; i < l; i++) {
-    BASE_len *= BASE;
-  }
-
-  // ローリングハッシュを使って出現位置を求める
-  uint32_t hash = 0;
-  std::vector<size_t> ret;
-  if (memcmp(src, str, l) == 0) {
-    ret.emplace_back(0);
+  // strtoullは負の数も受け付けてしまうので先に弾く
+  if (*p == '-') {
+    return false;
   }
-  for (size_t i = 0; i < l; i++) {
-    uint32_t v = src[i];
-    hash = hash * BASE + v;
+  char *end = nullptr;
+  errno = 0;
+  unsigned long long v = strtoull(p, &end, 0);
+  if (end == p || errno != 0) {
+    return false;
   }
-  for (size_t i = l; i < n; i++) {
-    // 1文字ごとに処理
-    uint32_t v = src[i];
-    uint32_t prev_v = src[i - l];
-    hash = hash * BASE + v - prev_v * BASE_len;
-    if (hash != rolling_hash) {
-      continue;
-    }
-    // 文字列が見つかった
-    // 誤検知が発生する可能性があるので実際に比較して確認する
-    size_t find_index = i - l + 1;
-    if (memcmp(src + find_index, str, l) == 0) {
-      ret.emplace_back(find_index);
-    }
-  }
-  return ret;
-}
-
-std::vector<size_t> StrstrByFloatFuzzyLookup(const uint8_t *src, const uint8_t *str_from, size_t n, size_t l) {
-
-  assert(src != nullptr);
-  assert(str_from != nullptr);
-  if (n < l || n == 0 || l == 0) {
-    return std::vector<size_t>();
+  int shift = 0;
+  switch (tolower(*end)) {
+  case 'g':
+    shift += 10;
+    // fall through
+  case 'm':
+    shift += 10;
+    // fall through
+  case 'k':
+    shift += 10;
+    end++;
+    break;
+  case '\0':
+    break;
+  default:
+    return false;
   }
-
-  // 検索文字列を数字に戻す
-  float min = 0.0f;
-  float max = 0.0f;
-  memcpy((uint8_t *)&min, str_from, 4);
-  max = min + 1.05f;
-  min = min - 0.55f; // 四捨五入のケース対応
-
-  std::vector<size_t> ret;
-  for (size_t i = 0; i < n - l; i++) {
-    float v = 0.0f;
-    memcpy((uint8_t *)&v, src + i, 4);
-
-    if (v < min || v > max || isnan(v)) {
-      continue;
-    }
-
-    // 文字列が見つかった
-    // 誤検知が発生する可能性があるので実際に比較して確認する
-    size_t find_index = i;
-    ret.emplace_back(find_index);
+  if (*end != '\0' || v > (SIZE_MAX >> shift)) {
+    return false;
   }
-  return ret;
+  size = (size_t)v << shift;
+  return true;
 }
 
 void ByteSerialize(FILE *fp, const std::vector<uint8_t> &byte) {
@@ -27,9 +27,9 @@
 namespace Utility {
 void DebugLog(const char *format, ...);
 void PrintErrnoString(const char *format, ...);
-std::vector<size_t> StrstrByRollingHash(const uint8_t *src, const uint8_t *str, size_t n, size_t l);
-std::vector<size_t> StrstrByFloatFuzzyLookup(const uint8_t *src, const uint8_t *str_from, size_t n, size_t l);
 std::string HexDump(size_t address, const char *comment, const uint8_t *data, size_t n, int indent);
+// 末尾のK, M, Gを単位として解釈する、数でない・負の数・知らない単位・大きすぎる場合はfalseを返す
+bool StringToSize(const std::string &str, size_t &size);
 
 void ByteSerialize(FILE *fp, const std::vector<uint8_t> &byte);
 std::vector<uint8_t> ByteDeSerialize(FILE *fp);
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#include "Lz4Block.h"
+
+namespace Lz4Block {
+
+// 一致の最短の長さ
+static const size_t MIN_MATCH = 4;
+// 最後のこのバイト数は必ずリテラルにする
+static const size_t LAST_LITERALS = 5;
+// 一致はブロックの終わりからこのバイト数より前で始まらなければならない
+static const size_t MFLIMIT = 12;
+static const int HASH_BITS = 12;
+
+static uint32_t Read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t Hash(uint32_t v) { return (v * 2654435761u) >> (32 - HASH_BITS); }
+
+// 15以上の長さは、tokenの4ビットに15を入れた残りを255ずつ続ける
+static uint8_t *WriteLength(uint8_t *op, size_t length) {
+  for (; length >= 255; length -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t)length;
+  return op;
+}
+
+// literal_sizeバイトのリテラルと、offset前からのmatch_sizeバイトの一致を1つの組として書く
+// match_sizeが0なら最後の組で、リテラルだけを書く
+static uint8_t *WriteSequence(uint8_t *op, const uint8_t *literal, size_t literal_size, size_t offset,
+                              size_t match_size) {
+  uint8_t *token = op++;
+  *token = (uint8_t)(std::min(literal_size, (size_t)15) << 4);
+  if (literal_size >= 15) {
+    op = WriteLength(op, literal_size - 15);
+  }
+  memcpy(op, literal, literal_size);
+  op += literal_size;
+  if (match_size == 0) {
+    return op;
+  }
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+  const size_t length = match_size - MIN_MATCH;
+  *token |= (uint8_t)std::min(length, (size_t)15);
+  if (length >= 15) {
+    op = WriteLength(op, length - 15);
+  }
+  return op;
+}
+
+// 1つの組を書くのに必要な最大のバイト数、token、長さ、offsetの分を足す
+static size_t SequenceBound(size_t literal_size, size_t match_size) {
+  return 1 + literal_size / 255 + 1 + literal_size + 2 + match_size / 255 + 1;
+}
+
+size_t Compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+  assert(size <= MAX_INPUT_SIZE);
+  uint16_t table[1 << HASH_BITS];
+  memset(table, 0, sizeof(table));
+  uint8_t *op = dst;
+  const uint8_t *const op_end = dst + capacity;
+  size_t anchor = 0;
+  if (size > MFLIMIT) {
+    const size_t match_limit = size - MFLIMIT;
+    const size_t extend_limit = size - LAST_LITERALS;
+    size_t ip = 1;
+    while (ip < match_limit) {
+      const uint32_t sequence = Read32(src + ip);
+      const uint32_t h = Hash(sequence);
+      const size_t ref = table[h];
+      table[h] = (uint16_t)ip;
+      if (ref >= ip || Read32(src + ref) != sequence) {
+        // 一致しない所が続くほど飛ばして探す
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      size_t match_size = MIN_MATCH;
+      while (ip + match_size < extend_limit && src[ref + match_size] == src[ip + match_size]) {
+        match_size++;
+      }
+      if (op + SequenceBound(ip - anchor, match_size) > op_end) {
+        return 0;
+      }
+      op = WriteSequence(op, src + anchor, ip - anchor, ip - ref, match_size);
+      ip += match_size;
+      anchor = ip;
+      if (ip - 2 < match_limit) {
+        table[Hash(Read32(src + ip - 2))] = (uint16_t)(ip - 2);
+      }
+    }
+  }
+  if (op + SequenceBound(size - anchor, 0) > op_end) {
+    return 0;
+  }
+  op = WriteSequence(op, src + anchor, size - anchor, 0, 0);
+  return op - dst;
+}
+
+// 15以上の長さの残りを読む、途中で入力が終わったらfalse
+static bool ReadLength(const uint8_t *&ip, const uint8_t *ip_end, size_t &length) {
+  uint8_t b;
+  do {
+    if (ip >= ip_end) {
+      return false;
+    }
+    b = *ip++;
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+bool Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size) {
+  const uint8_t *ip = src;
+  const uint8_t *const ip_end = src + size;
+  uint8_t *op = dst;
+  uint8_t *const op_end = dst + dst_size;
+  while (ip < ip_end) {
+    const uint8_t token = *ip++;
+    size_t literal_size = token >> 4;
+    if (literal_size == 15 && !ReadLength(ip, ip_end, literal_size)) {
+      return false;
+    }
+    if (literal_size > (size_t)(ip_end - ip) || literal_size > (size_t)(op_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, literal_size);
+    ip += literal_size;
+    op += literal_size;
+    if (ip == ip_end) {
+      // 最後の組はリテラルだけ
+      break;
+    }
+    if (ip_end - ip < 2) {
+      return false;
+    }
+    const size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) {
+      return false;
+    }
+    size_t match_size = token & 15;
+    if (match_size == 15 && !ReadLength(ip, ip_end, match_size)) {
+      return false;
+    }
+    match_size += MIN_MATCH;
+    if (match_size > (size_t)(op_end - op)) {
+      return false;
+    }
+    const uint8_t *match = op - offset;
+    if (offset >= match_size) {
+      memcpy(op, match, match_size);
+      op += match_size;
+    } else {
+      // 重なっている場合は繰り返しになるので1バイトずつ写す
+      for (size_t i = 0; i < match_size; i++) {
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == op_end;
+}
+
+} // namespace Lz4Block
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2024 DeNA Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * LZ4のブロック形式(https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)の圧縮と展開
+ * スナップショットのページ(数KB)を速く圧縮するためのもので、フレーム形式や辞書には対応しない
+ * 圧縮は4バイトのハッシュで直前の一致を1つだけ探す貪欲法、出力は標準のLZ4で展開できる
+ */
+namespace Lz4Block {
+// 圧縮できる入力の上限、一致の距離を16ビットで表せる範囲に収める
+static const size_t MAX_INPUT_SIZE = 64 * 1024;
+
+// srcを圧縮してdstに書き、書いたバイト数を返す、capacityに収まらなければ0を返す
+size_t Compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+// srcを展開してdstにちょうどdst_sizeバイト書けたらtrue、壊れたデータでもdstの外には書かない
+bool Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size);
+} // namespace Lz4Block